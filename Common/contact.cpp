@@ -19,6 +19,80 @@
 #include "../Common/util.hpp"
 #include "contact.hpp"
 
+#ifdef Q_OS_WIN
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+namespace {
+    bool hasScheme(const QChar *text, int len, const char *scheme) {
+        int pos = 0;
+        while(scheme[pos]) {
+            if(pos >= len || text[pos].toLower() != QLatin1Char(scheme[pos]))
+                return false;
+            ++pos;
+        }
+        return true;
+    }
+
+    // same result as QString::toInt(), without making the string
+    int portValue(const QChar *text, int len) {
+        int pos = 0;
+        while(pos < len && text[pos].isSpace())
+            ++pos;
+        while(len > pos && text[len - 1].isSpace())
+            --len;
+
+        bool negative = false;
+        if(pos < len && (text[pos] == QLatin1Char('+') || text[pos] == QLatin1Char('-')))
+            negative = (text[pos++] == QLatin1Char('-'));
+        if(pos >= len)
+            return 0;
+
+        qint64 value = 0;
+        while(pos < len) {
+            auto ch = text[pos++].unicode();
+            if(ch < '0' || ch > '9')
+                return 0;
+            value = value * 10 + (ch - '0');
+            if(value > 2147483648ll)
+                return 0;
+        }
+        if(negative)
+            value = -value;
+        if(value > 2147483647ll)
+            return 0;
+        return static_cast<int>(value);
+    }
+
+    bool parseAddress(const UString& host, quint8 *addr) {
+        char buf[INET6_ADDRSTRLEN + 2];
+        auto len = host.length();
+        auto text = host.constData();
+
+        if(len > 1 && text[0] == '[' && text[len - 1] == ']') {
+            ++text;
+            len -= 2;
+        }
+        if(len < 1 || len >= static_cast<int>(sizeof(buf)))
+            return false;
+
+        memcpy(buf, text, static_cast<size_t>(len));
+        buf[len] = 0;
+
+        memset(addr, 0, 16);
+        if(inet_pton(AF_INET, buf, addr + 12) == 1) {
+            addr[10] = addr[11] = 0xff;
+            return true;
+        }
+        return inet_pton(AF_INET6, buf, addr) == 1;
+    }
+}
+
 Contact::Contact(const UString& address, quint16 port, const UString& user, int duration) noexcept :
 userName(user), expiration(0)
 {
@@ -30,51 +104,92 @@ userName(user), expiration(0)
     }
 }
 
+// single pass over the uri, only the user and host results are allocated
 Contact::Contact(const QString& uri, QString server) noexcept :
 hostPort(0), expiration(0)
 {
+    auto text = uri.constData();
+    auto len = uri.length();
     int lead = 0;
 
-    if(uri.left(4).toLower() == "sip:") {
+    if(hasScheme(text, len, "sip:")) {
         hostPort = 5060;
         lead = 4;
     }
-    else if(uri.left(5).toLower() == "sips:") {
+    else if(hasScheme(text, len, "sips:")) {
         hostPort = 5061;
         lead = 5;
     }
 
-    int pos = uri.indexOf("@");
+    const QString *source = &server;
+    int from = 0;
+    int pos = uri.indexOf(QLatin1Char('@'));
     if(pos > 0) {
-        userName = uri.mid(lead, pos - lead);
-        server = uri.mid(pos + 1);
+        userName = uri.midRef(lead, pos - lead).toUtf8();
+        source = &uri;
+        from = pos + 1;
     } else {
-        userName = uri.mid(lead);
-        if(server.left(4).toLower() == "sip:") {
-            server = server.mid(4);
+        userName = uri.midRef(lead).toUtf8();
+        if(hasScheme(server.constData(), server.length(), "sip:")) {
+            from = 4;
             if(!hostPort)
                 hostPort = 5060;
         }
-        else if(server.left(5).toLower() == "sips:") {
-            server = server.mid(5);
+        else if(hasScheme(server.constData(), server.length(), "sips:")) {
+            from = 5;
             if(!hostPort)
                 hostPort = 5061;
         }
     }
-    lead = server.indexOf("[");
-    if(lead < 1)
-        lead = 0;
-
-    if(server.mid(lead).indexOf(":") == server.lastIndexOf(":"))
-    {
-        if(lead > 0)
-            hostName = server.left(lead);
+
+    auto host = source->constData() + from;
+    auto size = source->length() - from;
+    int first = -1, last = -1, bracket = -1, close = -1, inside = -1;
+    for(pos = 0; pos < size; ++pos) {
+        switch(host[pos].unicode()) {
+        case '[':
+            if(bracket < 0)
+                bracket = pos;
+            break;
+        case ']':
+            if(bracket > -1 && close < 0)
+                close = pos;
+            break;
+        case ':':
+            if(first < 0)
+                first = pos;
+            if(bracket > -1 && inside < 0)
+                inside = pos;
+            last = pos;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // bracketed ipv6 host, with an optional port after it...
+    if(bracket == 0 && close > 0 && (close + 1 == size || host[close + 1] == QLatin1Char(':'))) {
+        hostName = source->midRef(from, close + 1).toUtf8();
+        if(close + 1 < size)
+            hostPort = static_cast<quint16>(portValue(host + close + 2, size - close - 2));
+    }
+    else {
+        // a bracket past the start only bounds the host name
+        if(bracket < 1)
+            bracket = 0;
+        auto split = bracket ? (inside > -1 ? inside - bracket : -1) : first;
+        if(split == last) {
+            if(bracket > 0)
+                hostName = source->midRef(from, bracket).toUtf8();
+            else if(first > -1)
+                hostName = source->midRef(from, first).toUtf8();
+            else
+                hostName = source->midRef(from).toUtf8();
+            hostPort = static_cast<quint16>(portValue(host + last + 1, size - last - 1));
+        }
         else
-            hostName = server.left(server.indexOf(":"));
-        hostPort = static_cast<quint16>(server.mid(server.lastIndexOf(":") + 1).toInt());
+            hostName = source->midRef(from).toUtf8();
     }
-    else
-        hostName = server;
 
     if(!hostPort)
         hostPort = 5060;
@@ -177,6 +292,77 @@ void Contact::refresh(int seconds) {
     expiration += seconds;
 }
 
+Binding::Binding() noexcept :
+hostPort(0), hashValue(0), expiration(0)
+{
+    memset(hostAddress, 0, sizeof(hostAddress));
+}
+
+Binding::Binding(const Contact& contact) noexcept :
+hostPort(contact.port()), hashValue(0), userName(contact.user().copy()), expiration(contact.expires())
+{
+    memset(hostAddress, 0, sizeof(hostAddress));
+    auto host = contact.host();
+    if(host.isEmpty())
+        hostPort = 0;
+    else if(!parseAddress(host, hostAddress))
+        hostName = host.toLower();
+
+    hashValue = qHashBits(hostAddress, sizeof(hostAddress)) ^ qHash(hostName) ^ hostPort ^ qHash(userName);
+}
+
+const UString Binding::host() const
+{
+    if(!hostName.isEmpty())
+        return hostName;
+
+    if(!hostPort)
+        return UString();
+
+    char buf[INET6_ADDRSTRLEN];
+    static const quint8 mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if(!memcmp(hostAddress, mapped, sizeof(mapped)))
+        inet_ntop(AF_INET, const_cast<quint8 *>(hostAddress + 12), buf, sizeof(buf));
+    else
+        inet_ntop(AF_INET6, const_cast<quint8 *>(hostAddress), buf, sizeof(buf));
+    return UString(buf);
+}
+
+const Contact Binding::contact() const
+{
+    Contact result(host(), hostPort, userName);
+    if(expiration)
+        result.refresh(static_cast<int>(expiration - time(nullptr)));
+    return result;
+}
+
+bool Binding::hasExpired() const {
+    if(!expiration)
+        return false;
+    time_t now;
+    time(&now);
+    if(now >= expiration)
+        return true;
+    return false;
+}
+
+void Binding::refresh(int seconds) {
+    if(seconds < 0) {
+        expiration = 0;
+        return;
+    }
+
+    if(!expiration)
+        time(&expiration);
+    expiration += seconds;
+}
+
+QDebug operator<<(QDebug dbg, const Binding& addr)
+{
+    dbg.nospace() << "Binding(" << addr.host() << ":" << addr.port() << ")";
+    return dbg.maybeSpace();
+}
+
 QDebug operator<<(QDebug dbg, const Contact& addr)
 {
     time_t now, expireTime = addr.expires();
@@ -24,6 +24,7 @@
 #include <QHostAddress>
 #include <QPair>
 #include <QAbstractSocket>
+#include <cstring>
 #include <eXosip2/eXosip.h>
 
 #ifndef SIP_CONFLICT
@@ -106,7 +107,67 @@ private:
     }
 };
 
+class Binding final
+{
+public:
+    Binding() noexcept;
+    Binding(const Contact& contact) noexcept;
+    Binding(const Binding& from) noexcept = default;
+
+    Binding& operator=(const Binding& from) = default;
+
+    operator bool() const {
+        return hostPort != 0;
+    }
+
+    bool operator!() const {
+        return hostPort == 0;
+    }
+
+    bool operator==(const Binding& other) const {
+        return hashValue == other.hashValue && hostPort == other.hostPort && hostName == other.hostName && !memcmp(hostAddress, other.hostAddress, sizeof(hostAddress)) && userName == other.userName;
+    }
+
+    bool operator!=(const Binding& other) const {
+        return !(*this == other);
+    }
+
+    bool isNumeric() const {
+        return hostName.isEmpty();
+    }
+
+    time_t expires() const {
+        return expiration;
+    }
+
+    const UString user() const {
+        return userName;
+    }
+
+    quint16 port() const {
+        return hostPort;
+    }
+
+    const UString host() const;
+    const Contact contact() const;
+    bool hasExpired() const;
+    void refresh(int seconds);
+
+private:
+    quint8 hostAddress[16];     // numeric, ipv4 is mapped
+    quint16 hostPort;
+    uint hashValue;             // cached, seedless
+    UString hostName;           // lowercase, or empty if numeric
+    UString userName;
+    time_t expiration;
+
+    friend uint qHash(const Binding& key, uint seed) {
+        return key.hashValue ^ seed;
+    }
+};
+
 QDebug operator<<(QDebug dbg, const Contact& contact);
+QDebug operator<<(QDebug dbg, const Binding& binding);
 
 /*!
  * Manage information on internet connections.
@@ -121,6 +182,13 @@ QDebug operator<<(QDebug dbg, const Contact& contact);
  * host address so that the actual dns resolution happens in the eXosip2
  * library using the c-ares resolver.
  * \author David Sugar <tychosoft@gmail.com>
+ *
+ * \class Binding
+ * \brief A compact contact for long lived bindings.
+ * Numeric hosts are stored as a 16 byte address, with ipv4 addresses
+ * mapped, and only host names are kept as a string.  The hash is
+ * computed once when the binding is made.
+ * This is meant for registry bindings, where many are kept and looked up.
  */
 
 /*!
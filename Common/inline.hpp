@@ -19,6 +19,11 @@
 #define INLINE_HPP_
 
 #include "compiler.hpp"
+#include <QtGlobal>
+#include <QAtomicInteger>
+#include <new>
+#include <utility>
+#include <type_traits>
 
 namespace Util {
     template<typename T>
@@ -38,6 +43,185 @@ namespace Util {
     {
         return !(value < min || value > max);
     }
+
+    template<typename T, unsigned S>
+    class RingBuffer final
+    {
+        Q_DISABLE_COPY(RingBuffer)
+        static_assert(S > 1 && (S & (S - 1)) == 0, "ring size must be power of 2");
+
+    public:
+        RingBuffer() : head(0), tail(0) {}
+
+        ~RingBuffer() {
+            T item;
+            while(pull(item))
+                continue;
+        }
+
+        // only from producer thread
+        bool push(const T& item) {
+            unsigned pos = tail.load();
+            if(pos - head.loadAcquire() >= S)
+                return false;
+            new(&slots[pos & (S - 1)]) T(item);
+            tail.storeRelease(pos + 1);
+            return true;
+        }
+
+        // only from consumer thread
+        bool pull(T& item) {
+            unsigned pos = head.load();
+            if(tail.loadAcquire() == pos)
+                return false;
+            auto slot = reinterpret_cast<T *>(&slots[pos & (S - 1)]);
+            item = *slot;
+            slot->~T();
+            head.storeRelease(pos + 1);
+            return true;
+        }
+
+        unsigned count() const {
+            return tail.loadAcquire() - head.loadAcquire();
+        }
+
+        static unsigned size() {
+            return S;
+        }
+
+    private:
+        QAtomicInteger<unsigned> head;
+        char padHead[64 - sizeof(QAtomicInteger<unsigned>)];
+        QAtomicInteger<unsigned> tail;
+        char padTail[64 - sizeof(QAtomicInteger<unsigned>)];
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type slots[S];
+    };
+
+    template<typename T, unsigned N>
+    class SmallVector final
+    {
+        static_assert(N > 0, "inline capacity must be at least 1");
+
+    public:
+        typedef T value_type;
+        typedef T *iterator;
+        typedef const T *const_iterator;
+
+        SmallVector() : items(reinterpret_cast<T *>(local)), used(0), limit(N) {}
+
+        SmallVector(const SmallVector& from) : SmallVector() {
+            reserve(from.used);
+            for(unsigned pos = 0; pos < from.used; ++pos)
+                new(&items[pos]) T(from.items[pos]);
+            used = from.used;
+        }
+
+        ~SmallVector() {
+            clear();
+            if(!isInline())
+                ::operator delete(items);
+        }
+
+        SmallVector& operator=(const SmallVector& from) {
+            if(this == &from)
+                return *this;
+            clear();
+            reserve(from.used);
+            for(unsigned pos = 0; pos < from.used; ++pos)
+                new(&items[pos]) T(from.items[pos]);
+            used = from.used;
+            return *this;
+        }
+
+        SmallVector& operator<<(const T& item) {
+            append(item);
+            return *this;
+        }
+
+        void append(const T& item) {
+            if(used == limit) {
+                T copy(item);       // item may be one of ours
+                grow(limit * 2);
+                new(&items[used++]) T(std::move(copy));
+                return;
+            }
+            new(&items[used++]) T(item);
+        }
+
+        void reserve(unsigned size) {
+            if(size > limit)
+                grow(size);
+        }
+
+        void clear() {
+            while(used)
+                items[--used].~T();
+        }
+
+        T& operator[](unsigned pos) {
+            Q_ASSERT(pos < used);
+            return items[pos];
+        }
+
+        const T& operator[](unsigned pos) const {
+            Q_ASSERT(pos < used);
+            return items[pos];
+        }
+
+        const T& at(unsigned pos) const {
+            Q_ASSERT(pos < used);
+            return items[pos];
+        }
+
+        iterator begin() {
+            return items;
+        }
+
+        iterator end() {
+            return items + used;
+        }
+
+        const_iterator begin() const {
+            return items;
+        }
+
+        const_iterator end() const {
+            return items + used;
+        }
+
+        int count() const {
+            return static_cast<int>(used);
+        }
+
+        int size() const {
+            return static_cast<int>(used);
+        }
+
+        bool isEmpty() const {
+            return used == 0;
+        }
+
+        bool isInline() const {
+            return items == reinterpret_cast<const T *>(local);
+        }
+
+    private:
+        T *items;
+        unsigned used, limit;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type local[N];
+
+        void grow(unsigned size) {
+            auto heap = static_cast<T *>(::operator new(sizeof(T) * size));
+            for(unsigned pos = 0; pos < used; ++pos) {
+                new(&heap[pos]) T(std::move(items[pos]));
+                items[pos].~T();
+            }
+            if(!isInline())
+                ::operator delete(items);
+            items = heap;
+            limit = size;
+        }
+    };
 }
 
 /*!
@@ -49,4 +233,18 @@ namespace Util {
  * \namespace Util
  */
 
+/*!
+ * \class Util::RingBuffer
+ * \brief Lock-free single producer, single consumer ring.
+ * A fixed size ring of S items for handing objects between exactly two
+ * threads without allocation or locking.  Push is only ever called from
+ * the producer, and pull from the consumer.  Items are copy constructed in
+ * place, and released as soon as they are pulled.
+ *
+ * \class Util::SmallVector
+ * \brief Vector with inline storage for the first N items.
+ * Lists that are almost always short live in the object itself, and only
+ * spill to the heap once more than N items are appended.
+ */
+
 #endif
@@ -22,6 +22,7 @@
 #include <QByteArray>
 #include <QString>
 #include <QMetaType>
+#include <cstring>
 
 class UString : public QByteArray
 {
@@ -57,6 +58,11 @@ public:
         return QByteArray::toUpper();
     }
 
+    // deep copy, for views that must outlive what they point into
+    UString copy() const {
+        return QByteArray(constData(), size());
+    }
+
     bool isNumber() const;
     bool isLabel() const;
     UString unquote(const char *qc = "\"") const;
@@ -67,6 +73,19 @@ public:
         return QByteArray::number(num, base);
     }
 
+    // views share a c string without copying it, which must outlive them
+    static UString view(const char *cp) {
+        if(!cp)
+            return UString();
+        return QByteArray::fromRawData(cp, static_cast<int>(strlen(cp)));
+    }
+
+    static UString view(const char *cp, int size) {
+        if(!cp)
+            return UString();
+        return QByteArray::fromRawData(cp, size);
+    }
+
     static UString uri(const UString& schema, const UString& server, quint16 port);
     static UString uri(const UString& schema, const UString& id, const UString& server, quint16 port);
 };
@@ -131,7 +150,10 @@ Q_DECLARE_METATYPE(UString)
  * \brief A more C/C++ friendly string class.
  * Provides a simpler means to bridge the gap between QString's 32 bit
  * unicode, and simple utf8 strings that often are needed to directly
- * call C functions which use pure character functions.
+ * call C functions which use pure character functions.  A string may
+ * also be a view of c string data owned by something else, such as an
+ * osip message.  Views must be copied before they are kept longer than
+ * the data they point into.
  */
 
 #endif
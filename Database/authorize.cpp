@@ -42,7 +42,7 @@ QObject(), db(nullptr)
 
     // future connections for quick aync between manager and auth
     Manager *manager = Manager::instance();
-    connect(manager, &Manager::findEndpoint, this, &Authorize::findEndpoint);
+    connect(manager, &Manager::findEndpoint, this, &Authorize::seekEndpoint);
     connect(this, &Authorize::createEndpoint, manager, &Manager::createRegistration);
 }
 
@@ -62,6 +62,13 @@ void Authorize::init(unsigned order)
     Instance = new Authorize(order);
 }
 
+// overload accounting is done here, so overrides need not call the base
+void Authorize::seekEndpoint(const Event& event)
+{
+    Manager::authorized();
+    findEndpoint(event);
+}
+
 void Authorize::findEndpoint(const Event& event)
 {
     qDebug() << "Seeking endpoint" << event.number();
@@ -83,7 +90,7 @@ void Authorize::findEndpoint(const Event& event)
         {"user", "test"},
         {"digest", "MD5"},
         {"number", event.number()},
-        {"label", event.label()},
+        {"label", event.label().copy()},
     };
     emit createEndpoint(event, dummy);
 }
@@ -52,6 +52,9 @@ private:
 signals:
     void createEndpoint(const Event& event, const QVariantHash endpoint);
 
+private slots:
+    void seekEndpoint(const Event& event);
+
 protected slots:
     virtual void activate(const QVariantHash& config, bool isOpen);
     virtual void findEndpoint(const Event& event);
@@ -50,6 +50,8 @@ private:
 
 RequestEvent::~RequestEvent() {}
 
+QAtomicInt Request::Pending(0);
+
 // NOTE: Use case may be something like
 // emit DB_AUTHORIZE(new Request(this, event, &authResponse, 10000))
 // database receiver processes if(!request->cancelled())
@@ -57,6 +59,8 @@ RequestEvent::~RequestEvent() {}
 Request::Request(QObject *parent, const Event& sip, int expires) :
 QObject(parent), sipEvent(sip), signalled(false)
 {
+    Pending.ref();
+
     // compute propogation delay...
     expires -= sip.elapsed() - 20;
     if(expires < 10)
@@ -67,6 +71,7 @@ QObject(parent), sipEvent(sip), signalled(false)
 Request::Request(QObject *parent, const Event& sip, int expires, Reply method) :
 QObject(parent), sipEvent(sip), signalled(false)
 {
+    Pending.ref();
     connect(this, &Request::results, parent, method);
 
     // compute propogation delay...
@@ -77,6 +82,11 @@ QObject(parent), sipEvent(sip), signalled(false)
         QTimer::singleShot(expires, Qt::CoarseTimer, this, &Request::timeout);
 }
 
+Request::~Request()
+{
+    Pending.deref();
+}
+
 void Request::timeout()
 {
     if(!signalled) {
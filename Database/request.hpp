@@ -24,6 +24,7 @@
 #include <QSqlRecord>
 #include <QSqlQuery>
 #include <QTimer>
+#include <QAtomicInt>
 
 #include "../Server/event.hpp"
 
@@ -46,6 +47,7 @@ public:
 
     Request(QObject *parent, const Event& sip, int expires);
     Request(QObject *parent, const Event& sip, int expires, Reply method);
+    ~Request() final;
 
     const Event& event() const {
         return sipEvent;
@@ -57,6 +59,10 @@ public:
 
     bool cancelled(void);
 
+    inline static int pending() {
+        return Pending.load();
+    }
+
     void notifySuccess(QSqlQuery &results, ErrorResult error = Success);
     void notifyFailed(ErrorResult error = DbFailed);
 	
@@ -65,6 +71,8 @@ private:
     Event sipEvent;
     volatile bool signalled;
 
+    static QAtomicInt Pending;          // live requests for overload control
+
     bool event(QEvent *evt) final;
 
 signals:
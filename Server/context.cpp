@@ -18,8 +18,12 @@
 #include "server.hpp"
 #include "output.hpp"
 #include "manager.hpp"
+#include "trace.hpp"
 
 #include <QNetworkInterface>
+#include <QSemaphore>
+#include <cstring>
+#include <cstdio>
 
 #if defined(Q_OS_WIN)
 #include <WinSock2.h>
@@ -29,12 +33,31 @@
 #include <unistd.h>
 #endif
 
+#if defined(Q_OS_LINUX)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define EVENT_EPOLL
+#endif
+
 #define EVENT_TIMER 500l    // 500ms...
+#define ACTION_TIMER 1000l  // automatic actions once a second
+#define EVENT_BATCH 64      // most events drained per wakeup
+#define STARTUP_TIMEOUT 10000  // longest wait for contexts to bind
+#define OPTIONS_ALLOW "INVITE, ACK, OPTIONS, BYE, CANCEL, REGISTER, MESSAGE"
+
+static volatile bool active = true;
 
-static bool active = true;
+#ifdef EVENT_EPOLL
+// never read, so once kicked it stays readable for every context...
+static int shutdownEvent = -1;
+#endif
+
+static QSemaphore startup;
 
-volatile unsigned Context::instanceCount = 0;
+QAtomicInt Context::instanceCount(0);
 QList<Context *> Context::Contexts;
+QMutex Context::ContextLock;
+QList<EventQueue *> Context::Queues;
 QList<Context::Schema> Context::Schemas = {
     {"udp", "sip:",  Context::UDP, 5060, IPPROTO_UDP},
     {"tcp", "sip:",  Context::TCP, 5060, IPPROTO_TCP},
@@ -61,8 +84,8 @@ private:
 };
 
 
-Context::Context(const QHostAddress& addr, quint16 port, const Schema& choice, unsigned mask, unsigned index):
-schema(choice), context(nullptr), netFamily(AF_INET), netPort(port)
+Context::Context(const QHostAddress& addr, quint16 port, const Schema& choice, unsigned mask, unsigned index, int id):
+schema(choice), context(nullptr), options(nullptr), poller(-1), wakeup(-1), worker(id), events(new EventQueue), replies(new ReplyQueue), bindAddress(addr), netFamily(AF_INET), netPort(port), localNames(nullptr), pool(Event::createPool())
 {
     allow = mask & 0xffffff00;
     netPort &= 0xfffe;
@@ -74,6 +97,20 @@ schema(choice), context(nullptr), netFamily(AF_INET), netPort(port)
     eXosip_init(context);
     eXosip_set_user_agent(context, UString("SipWitchQt-server/") + PROJECT_VERSION);
 
+    // pre-built static part of our keepalive options answer
+    if(!osip_message_init(&options)) {
+        osip_message_set_version(options, osip_strdup("SIP/2.0"));
+        osip_message_set_status_code(options, SIP_OK);
+        osip_message_set_reason_phrase(options, osip_strdup(osip_message_get_reason(SIP_OK)));
+        osip_message_set_header(options, USER_AGENT, UString("SipWitchQt-server/") + PROJECT_VERSION);
+        osip_message_set_accept(options, "application/sdp");
+        osip_message_set_accept_language(options, "en");
+        osip_message_set_allow(options, OPTIONS_ALLOW);
+        osip_message_set_content_length(options, "0");
+    }
+    else
+        options = nullptr;
+
     auto proto = addr.protocol();
     int ipv6 = 0, rport = 1, dns = 2;
 #ifdef AF_INET6
@@ -89,8 +126,13 @@ schema(choice), context(nullptr), netFamily(AF_INET), netPort(port)
     if(!addr.isNull())
         netAddress = addr.toString().toUtf8();
 
-    setObjectName(QString("sip") + QString::number(index) + "/" + choice.name);
+    if(worker > -1)
+        setObjectName(QString("sip") + QString::number(index) + "/" + choice.name + "/" + QString::number(worker));
+    else
+        setObjectName(QString("sip") + QString::number(index) + "/" + choice.name);
+    tracing = Trace::context(objectName());
     Contexts << this;
+    Queues << events;
 
     if(addr != QHostAddress::Any && addr != QHostAddress::AnyIPv4 && addr != QHostAddress::AnyIPv6) {
         multiInterface = false;
@@ -104,14 +146,11 @@ schema(choice), context(nullptr), netFamily(AF_INET), netPort(port)
         uriAddress = QHostInfo::localHostName().toUtf8();
     }
 
-    // reverse lookup so we can use interface name rather than addr...
-    if(!netAddress.isEmpty() && netAddress != "0.0.0.0") {
-        QHostInfo host = QHostInfo::fromName(netAddress);
-        if(host.error() == QHostInfo::NoError)
-            localHosts << host.hostName();
+    // interface name is resolved when the context thread starts...
+    if(!netAddress.isEmpty() && netAddress != "0.0.0.0")
         localHosts << netAddress;
-    }
     localHosts << QHostInfo::localHostName() << Util::localDomain();
+    publishNames();
 
     uriHost = uriAddress;
     if(netPort != schema.inPort)
@@ -123,6 +162,18 @@ schema(choice), context(nullptr), netFamily(AF_INET), netPort(port)
 
 Context::~Context()
 {
+#ifdef EVENT_EPOLL
+    if(poller > -1)
+        ::close(poller);
+    if(wakeup > -1)
+        ::close(wakeup);
+#endif
+    delete replies;
+    pool->retire();
+    delete localNames.loadAcquire();
+    qDeleteAll(retiredNames);
+    if(options)
+        osip_message_free(options);
     if(context)
         eXosip_quit(context);
 }
@@ -151,16 +202,25 @@ QAbstractSocket::NetworkLayerProtocol Context::protocol()
         return QAbstractSocket::IPv6Protocol;
 }
 
-void Context::run()
+// reverse lookup so we can use interface name rather than addr...
+void Context::resolve()
 {
-    ++instanceCount;
+    if(netAddress.isEmpty() || netAddress == "0.0.0.0")
+        return;
+
+    QHostInfo host = QHostInfo::fromName(netAddress);
+    if(host.error() != QHostInfo::NoError)
+        return;
 
-    // connect events to state handlers when we run...
-    auto stack = Manager::instance();
-    if(allow & Allow::REGISTRY)
-        connect(this, &Context::REQUEST_REGISTER, stack, &Manager::refreshRegistration);
+    QMutexLocker lock(&nameLock);
+    localHosts << host.hostName();
+    publishNames();
+}
 
+void Context::run()
+{
     debug() << "Running " << objectName();
+    resolve();
 
     const char *ap = nullptr;
 
@@ -170,98 +230,469 @@ void Context::run()
     else if(netAddress == "0.0.0.0")
         ap = nullptr;
 
-    priorEvent = 0;
-    
     //qDebug() << "LISTEN " << proto << ap << port << family << NetTLS;
-    if(eXosip_listen_addr(context, netProto, ap, netPort, netFamily, netTLS)) {
+    if(worker > -1) {
+        if(!listenShared()) {
+            error() << objectName() << ": failed to bind shared port";
+            context = nullptr;
+        }
+    }
+    else if(eXosip_listen_addr(context, netProto, ap, netPort, netFamily, netTLS)) {
         error() << objectName() << ": failed to bind and listen";
         context = nullptr;
     }
 
+    // report to the startup barrier, failed contexts are dropped first...
+    if(context) {
+        setupEvents();
+        ++instanceCount;
+        debug() << "Listening " << objectName();
+    }
+    else {
+        QMutexLocker lock(&ContextLock);
+        Contexts.removeAll(this);
+    }
+    startup.release();
+
+    // automatic actions are driven from a monotonic deadline
+    QElapsedTimer clock;
+    QVector<Event> ready;
+    QVector<eXosip_event_t *> refused;
+    qint64 deadline = 0;
+    bool backlog = false;
+    clock.start();
+    ready.reserve(EVENT_BATCH);
+    refused.reserve(EVENT_BATCH);
+
     while(active && context) {
-        int s = EVENT_TIMER / 1000l;
-        int ms = EVENT_TIMER % 1000l;
-        Event event(eXosip_event_wait(context, s, ms), this);
-        time(&currentEvent);
-        if(currentEvent != priorEvent) {
-            priorEvent = currentEvent;
-            ContextLocker lock(context);    // scope lock automatic block...
-            eXosip_automatic_action(context);
+        // no name snapshot is held between loop passes...
+        if(retiring.loadAcquire())
+            reclaimNames();
+
+        auto now = clock.elapsed();
+        auto timeout = static_cast<int>(deadline - now);
+        auto due = timeout <= 0;
+        if(due) {
+            deadline = now + ACTION_TIMER;
+            timeout = 0;
         }
-        if(!event)
-            continue;
+        else if(backlog)
+            timeout = 0;
+
+        if(poller > -1) {
+            if(timeout > 0)
+                wait(timeout);
+            timeout = 0;
+        }
+        else if(timeout > EVENT_TIMER)
+            timeout = EVENT_TIMER;
+
+        // drain ready events, only the first may block when polling...
+        while(active && ready.count() + refused.count() < EVENT_BATCH) {
+            auto evt = eXosip_event_wait(context, timeout / 1000, timeout % 1000);
+            if(!evt)
+                break;
+
+            timeout = 0;
 
-        // skip extra code in event loop if we don't need it...
-        if(Server::verbose())
-            qDebug() << event;
+            // flooding sources are refused before we parse anything...
+            if(!throttle.check(evt)) {
+                refused << evt;
+                continue;
+            }
+
+            Event event(evt, this);
+
+            // skip extra code in event loop if we don't need it...
+            if(Server::verbose())
+                qDebug() << event;
+
+            ready << event;
+        }
 
-        if(Server::state() == Server::UP && process(event))
+        backlog = ready.count() + refused.count() >= EVENT_BATCH;
+        auto mail = kicked.loadAcquire() != 0;
+        if(ready.isEmpty() && refused.isEmpty() && !due && !mail)
             continue;
+
+        if(!ready.isEmpty()) {
+            ++drains;
+            drained += static_cast<quint64>(ready.count());
+        }
+
+        // one lock for automatic actions and local replies of the batch...
+        auto queued = 0;
+        {
+            ContextLocker lock(context);
+            if(due)
+                eXosip_automatic_action(context);
+
+            if(mail)
+                deliver();
+
+            foreach(auto evt, refused) {
+                if(evt->type == EXOSIP_CALL_INVITE)
+                    eXosip_call_send_answer(context, evt->tid, SIP_SERVICE_UNAVAILABLE, nullptr);
+                else
+                    eXosip_message_send_answer(context, evt->tid, SIP_SERVICE_UNAVAILABLE, nullptr);
+            }
+
+            if(Server::state() == Server::UP) {
+                foreach(auto event, ready) {
+                    if(!process(event))
+                        continue;
+                    if(events->push(event))
+                        ++queued;
+                    else
+                        busy(event);
+                }
+            }
+        }
+        ready.clear();
+
+        foreach(auto evt, refused)
+            eXosip_event_free(evt);
+        refused.clear();
+
+        if(queued) {
+            Manager::queued(queued);
+            Manager::wakeup();
+        }
     }
-    debug() << "Exiting " << objectName();
+    debug() << "Exiting " << objectName() << ", average batch " << averageBatch() << ", shed " << shed.load() << ", throttled " << throttle.dropped();
     emit finished();
-    --instanceCount;
+    if(context)
+        --instanceCount;
+}
+
+// bind our own SO_REUSEPORT udp socket and hand it to exosip...
+bool Context::listenShared()
+{
+#if defined(SO_REUSEPORT) && !defined(Q_OS_WIN)
+    auto so = ::socket(netFamily, SOCK_DGRAM, IPPROTO_UDP);
+    if(so < 0)
+        return false;
+
+    int on = 1;
+    ::setsockopt(so, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(::setsockopt(so, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        ::close(so);
+        return false;
+    }
+
+    int result;
+#ifdef AF_INET6
+    if(netFamily == AF_INET6) {
+        struct sockaddr_in6 sin6;
+        auto addr = bindAddress.toIPv6Address();
+        memset(&sin6, 0, sizeof(sin6));
+        sin6.sin6_family = AF_INET6;
+        sin6.sin6_port = htons(netPort);
+        memcpy(&sin6.sin6_addr, &addr, sizeof(sin6.sin6_addr));
+        ::setsockopt(so, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+        result = ::bind(so, reinterpret_cast<struct sockaddr *>(&sin6), sizeof(sin6));
+    }
+    else
+#endif
+    {
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(netPort);
+        sin.sin_addr.s_addr = htonl(bindAddress.toIPv4Address());
+        result = ::bind(so, reinterpret_cast<struct sockaddr *>(&sin), sizeof(sin));
+    }
+
+    // exosip owns the socket once accepted...
+    if(result < 0 || eXosip_set_socket(context, IPPROTO_UDP, so, netPort)) {
+        ::close(so);
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
 }
 
+// setup event driven waits on the exosip event pipe if we can...
+void Context::setupEvents()
+{
+#ifdef EVENT_EPOLL
+    auto pipe = eXosip_event_geteventsocket(context);
+    if(pipe < 0 || shutdownEvent < 0)
+        return;
+
+    poller = epoll_create1(EPOLL_CLOEXEC);
+    if(poller < 0)
+        return;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = pipe;
+    if(!epoll_ctl(poller, EPOLL_CTL_ADD, pipe, &ev)) {
+        ev.data.fd = shutdownEvent;
+        if(!epoll_ctl(poller, EPOLL_CTL_ADD, shutdownEvent, &ev)) {
+            // mailbox kicks, stack replies are sent from our thread...
+            auto fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            ev.data.fd = fd;
+            if(fd > -1 && !epoll_ctl(poller, EPOLL_CTL_ADD, fd, &ev))
+                wakeup = fd;
+            else if(fd > -1)
+                ::close(fd);
+            return;
+        }
+    }
+
+    warning() << objectName() << ": using polled events";
+    ::close(poller);
+    poller = -1;
+#endif
+}
+
+// block until exosip events, mailbox replies, or deadline...
+void Context::wait(int timeout)
+{
+#ifdef EVENT_EPOLL
+    struct epoll_event events[3];
+    char buf[64];
+
+    auto count = epoll_wait(poller, events, 3, timeout);
+    for(auto pos = 0; pos < count; ++pos) {
+        auto fd = events[pos].data.fd;
+        if(fd == shutdownEvent)
+            continue;
+
+        // clear event pipe or kick before draining...
+        if(::read(fd, buf, sizeof(buf)) < 0)
+            continue;
+    }
+#else
+    Q_UNUSED(timeout);
+#endif
+}
+
+// called with exosip locked, true if event is passed to manager...
 bool Context::process(const Event& ev)
 {
     switch(ev.type()) {
     case EXOSIP_MESSAGE_NEW:
         if(MSG_IS_OPTIONS(ev.message())) {
             if(ev.isLocal() && !ev.target().hasUser()) {
-                return reply(ev, SIP_OK);
+                keepalive(ev);
+                return false;
+            }
+            auto code = ev.isLocal() ? reachable(ev.target().user()) : 0;
+            if(code) {
+                answer(ev, code);
+                return false;
             }
             emit REQUEST_OPTIONS(ev);
         }
         if(MSG_IS_REGISTER(ev.message())) {
             if(!(allow & Allow::REGISTRY))
                 return false;
-            emit REQUEST_REGISTER(ev);
+            if(Manager::isOverloaded()) {
+                busy(ev);
+                return false;
+            }
+            return true;
         }
         else
             return false;
-        break;
+    case EXOSIP_CALL_INVITE:
+        if(ev.isLocal() && ev.target().hasUser()) {
+            if(reachable(ev.target().user()) == SIP_TEMPORARILY_UNAVAILABLE) {
+                answer(ev, SIP_TEMPORARILY_UNAVAILABLE);
+                return false;
+            }
+        }
+        emit CALL_INVITE(ev);
+        return false;
     default:
         return false;
     }
+}
 
-    return true;
+// called from context threads, how a registered target would be answered,
+// or 0 if none are registered and the stack should check provisioning...
+int Context::reachable(const UString& target)
+{
+    auto list = Registry::lookup(target);
+    if(list.isEmpty())
+        return 0;
+
+    foreach(auto item, list) {
+        if(item.context)
+            return SIP_OK;
+    }
+    return SIP_TEMPORARILY_UNAVAILABLE;
 }
 
-void Context::challenge(const Event &event, Registry *registry)
+// called with exosip locked, answer keepalive from our template...
+void Context::keepalive(const Event& ev)
 {
-    char buf[8];
+    auto req = ev.message();
     osip_message_t *msg = nullptr;
-    auto ctx = event.context();
-    auto context = ctx->context;
-    auto tid = event.tid();
-    auto record = registry->data();
 
-    eXosip_generate_random(buf, sizeof(buf));
-    QByteArray random(buf, sizeof(buf));
+    if(!options || !req->from || !req->to || !req->call_id || !req->cseq || osip_message_clone(options, &msg)) {
+        answer(ev, SIP_OK);
+        return;
+    }
+
+    // only patch in the headers that identify the transaction...
+    osip_from_clone(req->from, &msg->from);
+    osip_to_clone(req->to, &msg->to);
+    osip_call_id_clone(req->call_id, &msg->call_id);
+    osip_cseq_clone(req->cseq, &msg->cseq);
+    osip_list_clone(&req->vias, &msg->vias, reinterpret_cast<int (*)(void *, void **)>(&osip_via_clone));
+
+    osip_generic_param_t *tag = nullptr;
+    if(msg->to && osip_to_get_tag(msg->to, &tag) != 0) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u", osip_build_random_number());
+        osip_to_set_tag(msg->to, osip_strdup(buf));
+    }
+    msg->message_property = 2;
+
+    if(!msg->from || !msg->to || !msg->call_id || !msg->cseq) {
+        osip_message_free(msg);
+        answer(ev, SIP_OK);
+        return;
+    }
+    eXosip_options_send_answer(context, ev.tid(), SIP_OK, msg);
+}
 
-    UString nonce = random.toHex().toLower();
-    UString realm = record.value("realm").toString().toUtf8();
-    UString digest = record.value("digest").toString().toUtf8().toUpper();
-    UString user = record.value("user").toString().toUtf8();
-    UString challenge = "Digest realm=" + realm.quote() + ", nonce=" + nonce.quote() + ", algorithm=" + digest.quote();
-    registry->setNounce(random);
+bool Context::canShare()
+{
+#if defined(SO_REUSEPORT) && !defined(Q_OS_WIN)
+    return true;
+#else
+    return false;
+#endif
+}
 
-    ContextLocker lock(context);
-    eXosip_message_build_answer(context, tid, SIP_UNAUTHORIZED, &msg);
-    osip_message_set_header(msg, WWW_AUTHENTICATE, challenge);
+void Context::challenge(const Event &event, Registry *registry, bool stale)
+{
+    auto nonce = Manager::nonce(registry->realm(), event.source());
 
     // part of sipwitchqt client first trust/initial contact setup
+    UString user;
     if(event.initialize() == "label")
-        osip_message_set_header(msg, "X-Authorize", user);
+        user = registry->authorizeId();
 
-    eXosip_message_send_answer(context, tid, SIP_UNAUTHORIZED, msg);
+    event.context()->post({event, SIP_UNAUTHORIZED, registry->challenge(nonce, stale), user});
 }
 
 bool Context::reply(const Event& event, int code)
+{
+    return event.context()->post({event, code, UString(), UString()});
+}
+
+// replies from the stack are sent from our own event thread...
+bool Context::post(const Reply& reply)
+{
+    auto current = QThread::currentThread();
+
+    // already in our event thread, or have no mailbox wakeup...
+    if(current == thread() || wakeup < 0) {
+        ContextLocker lock(context);
+        return answer(reply);
+    }
+
+    // only the stack may use the lock-free mailbox...
+    if(current != Manager::instance()->thread() || !replies->push(reply)) {
+        QMutexLocker lock(&mailLock);
+        mailbox << reply;
+        overflow.storeRelease(1);
+    }
+
+    if(kicked.testAndSetOrdered(0, 1)) {
+#ifdef EVENT_EPOLL
+        quint64 kick = 1;
+        if(::write(wakeup, &kick, sizeof(kick)) < 0)
+            warning() << objectName() << ": mailbox kick failed";
+#endif
+    }
+    return true;
+}
+
+// called with exosip locked...
+bool Context::answer(const Reply& reply)
+{
+    if(reply.authenticate.isEmpty())
+        return answer(reply.event, reply.code);
+
+    osip_message_t *msg = nullptr;
+    auto tid = reply.event.tid();
+    eXosip_message_build_answer(context, tid, reply.code, &msg);
+    if(!msg)
+        return false;
+
+    osip_message_set_header(msg, WWW_AUTHENTICATE, reply.authenticate);
+    if(!reply.authorize.isEmpty())
+        osip_message_set_header(msg, "X-Authorize", reply.authorize);
+
+    eXosip_message_send_answer(context, tid, reply.code, msg);
+    return true;
+}
+
+// called with exosip locked, sends all replies posted to us...
+void Context::deliver()
+{
+    Reply reply;
+
+    kicked.fetchAndStoreOrdered(0);
+    while(replies->pull(reply))
+        answer(reply);
+
+    if(!overflow.loadAcquire())
+        return;
+
+    QList<Reply> list;
+    mailLock.lock();
+    list.swap(mailbox);
+    overflow.storeRelease(0);
+    mailLock.unlock();
+
+    foreach(auto posted, list) {
+        answer(posted);
+    }
+}
+
+// called with exosip locked, shed a new request with a retry after...
+void Context::busy(const Event& ev)
+{
+    osip_message_t *msg = nullptr;
+    auto tid = ev.tid();
+    auto retry = UString::number(Manager::retryAfter());
+
+    ++shed;
+    switch(ev.type()) {
+    case EXOSIP_MESSAGE_NEW:
+        eXosip_message_build_answer(context, tid, SIP_SERVICE_UNAVAILABLE, &msg);
+        if(!msg)
+            break;
+        osip_message_set_header(msg, "Retry-After", retry);
+        eXosip_message_send_answer(context, tid, SIP_SERVICE_UNAVAILABLE, msg);
+        return;
+    case EXOSIP_CALL_INVITE:
+        eXosip_call_build_answer(context, tid, SIP_SERVICE_UNAVAILABLE, &msg);
+        if(!msg)
+            break;
+        osip_message_set_header(msg, "Retry-After", retry);
+        eXosip_call_send_answer(context, tid, SIP_SERVICE_UNAVAILABLE, msg);
+        return;
+    default:
+        break;
+    }
+    answer(ev, SIP_SERVICE_UNAVAILABLE);
+}
+
+// called with exosip locked...
+bool Context::answer(const Event& event, int code)
 {
     osip_message_t *msg = nullptr;
-    auto context = event.context()->context;
     auto tid = event.tid();
     auto did = event.did();
     auto cid = event.cid();
@@ -269,7 +700,6 @@ bool Context::reply(const Event& event, int code)
     Q_UNUSED(did);
     Q_UNUSED(cid);
 
-    ContextLocker lock(context);
     switch(event.type()) {
     case EXOSIP_MESSAGE_NEW:
         if(MSG_IS_OPTIONS(event.message())) {
@@ -292,6 +722,9 @@ bool Context::reply(const Event& event, int code)
             return true;
         }
         break;
+    case EXOSIP_CALL_INVITE:
+        eXosip_call_send_answer(context, tid, code, nullptr);
+        return true;
     default:
         break;
     }
@@ -301,7 +734,13 @@ bool Context::reply(const Event& event, int code)
 
 void Context::start(QThread::Priority priority)
 {
-    foreach(auto context, Contexts) {
+#ifdef EVENT_EPOLL
+    if(shutdownEvent < 0)
+        shutdownEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#endif
+
+    auto list = contexts();
+    foreach(auto context, list) {
         auto thread = new QThread;
         thread->setObjectName(context->objectName());
         context->moveToThread(thread);
@@ -310,14 +749,15 @@ void Context::start(QThread::Priority priority)
         connect(context, &Context::finished, thread, &QThread::quit);
         connect(context, &Context::finished, context, &QObject::deleteLater);
         connect(thread, &QThread::finished, thread, &QThread::deleteLater);
-
-        QThread::msleep(20);
         thread->start(priority);
     }
-    QThread::msleep(100);
-    if(!instanceCount)
+
+    // contexts bind in parallel, so we wait for the slowest...
+    if(!startup.tryAcquire(list.count(), STARTUP_TIMEOUT))
+        warning() << "Contexts still binding after " << STARTUP_TIMEOUT << "ms";
+    if(!instanceCount.load())
         crit(99) << "** No contexts available";
-    debug() << "Started contexts " << instanceCount;
+    debug() << "Started contexts " << instanceCount.load() << " of " << list.count();
 }
 
 void Context::shutdown()
@@ -325,9 +765,18 @@ void Context::shutdown()
     debug() << "Shutdown contexts " << instanceCount;
     active = false;
 
+#ifdef EVENT_EPOLL
+    // wake every context blocked in epoll at once...
+    if(shutdownEvent > -1) {
+        quint64 kick = 1;
+        if(::write(shutdownEvent, &kick, sizeof(kick)) < 0)
+            warning() << "Shutdown kick failed";
+    }
+#endif
+
     unsigned hanged = 50;   // up to 5 seconds, after we force...
 
-    while(instanceCount && hanged--) {
+    while(instanceCount.load() && hanged--) {
         QThread::msleep(100);
     }
 }
@@ -349,21 +798,35 @@ void Context::applyHostnames(const QStringList& names, const QString& host)
         otherNames << host;
     otherNames << names;
     publicName = host.toUtf8();
+    publishNames();
 }
 
-const QStringList Context::localnames() const
+// Builds a new immutable name set and publishes it for lock-free lookup
+// by isLocal(), called with nameLock held.  The context thread may still
+// hold prior snapshots, so they are retired and freed by that thread
+// between loop passes when it cannot be using any of them.
+void Context::publishNames()
 {
-    QStringList names = localHosts;
-    QMutexLocker lock(&nameLock);
-    names << otherNames;
+    auto names = new NameSet();
+    foreach(auto name, localHosts)
+        names->insert(name);
+    foreach(auto name, otherNames)
+        names->insert(name);
     if(publicName.length() > 0)
-        names << publicName;
-    names << QHostInfo::localHostName();
-    return names;
-}
-
-
-
-
+        names->insert(publicName);
+    names->insert(QHostInfo::localHostName());
 
+    auto prior = localNames.fetchAndStoreOrdered(names);
+    if(prior) {
+        retiredNames << prior;
+        retiring.storeRelease(1);
+    }
+}
 
+void Context::reclaimNames()
+{
+    QMutexLocker lock(&nameLock);
+    qDeleteAll(retiredNames);
+    retiredNames.clear();
+    retiring.storeRelease(0);
+}
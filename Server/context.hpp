@@ -19,10 +19,17 @@
 #define CONTEXT_HPP_
 
 #include "event.hpp"
+#include "throttle.hpp"
+#include "../Common/inline.hpp"
 #include <QSqlRecord>
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QSet>
 
 class Registry;
 
+typedef Util::RingBuffer<Event, 1024> EventQueue;
+
 class Context final : public QObject
 {
     Q_DISABLE_COPY(Context)
@@ -42,6 +49,13 @@ public:
         UNAUTHENTICATED =   1 << 10,    // unathenticated requests allowed
     };
 
+    typedef struct {
+        Event event;
+        int code;
+        UString authenticate;           // www-authenticate for challenges
+        UString authorize;              // x-authorize for initial trust
+    } Reply;
+
     typedef struct {
         UString name;
         UString uri;
@@ -52,7 +66,7 @@ public:
 
     QAbstractSocket::NetworkLayerProtocol protocol();
 
-    Context(const QHostAddress& bind, quint16 port, const Schema& choice, unsigned mask, unsigned index = 1);
+    Context(const QHostAddress& bind, quint16 port, const Schema& choice, unsigned mask, unsigned index = 1, int worker = -1);
 
     const Contact contact(const UString& username = UString()) const {
         return Contact(uriHost, netPort, username);
@@ -76,10 +90,32 @@ public:
         return schema.inPort;
     }
 
+    // only the context thread reads the published names...
     inline bool isLocal(const UString& host) const {
-        if(localHosts.contains(host))
-            return true;
-        return localnames().contains(host);
+        return localNames.loadAcquire()->contains(host);
+    }
+
+    inline bool isLocal(const char *host) const {
+        return isLocal(UString::view(host));
+    }
+
+    inline double averageBatch() const {
+        quint64 count = drains.load();
+        if(!count)
+            return 0.0;
+        return static_cast<double>(drained.load()) / static_cast<double>(count);
+    }
+
+    inline quint16 traceId() const {
+        return tracing;
+    }
+
+    inline EventPool *eventPool() const {
+        return pool;
+    }
+
+    inline const Throttle& limits() const {
+        return throttle;
     }
 
     const UString hostname() const;
@@ -91,42 +127,81 @@ public:
     }
 
     inline static const QList<Context *> contexts() {
+        QMutexLocker lock(&ContextLock);
         return Contexts;
     }
 
+    inline static const QList<EventQueue *> queues() {
+        return Queues;
+    }
+
     inline static bool isActive() {
-        return instanceCount > 0;
+        return instanceCount.load() > 0;
     }
 
-    static void challenge(const Event& event, Registry *registry);
+    static bool canShare();
+    static void challenge(const Event& event, Registry *registry, bool stale = false);
     static bool reply(const Event& event, int code);
     static void start(QThread::Priority priority = QThread::InheritPriority);
     static void shutdown();
 
 private:
+    typedef Util::RingBuffer<Reply, 1024> ReplyQueue;
+    typedef QSet<UString> NameSet;
+
     const Schema schema;
     unsigned allow;
     eXosip_t *context;
-    time_t currentEvent, priorEvent;
+    osip_message_t *options;            // keepalive answer template
+    int poller;                         // epoll fd or -1 if polling
+    int wakeup;                         // mailbox eventfd or -1
+    int worker;                         // shared port worker or -1
+    EventQueue *events;                 // events handed to manager
+    ReplyQueue *replies;                // replies from manager
+    QList<Reply> mailbox;               // replies from other threads
+    QMutex mailLock;
+    QAtomicInt kicked, overflow;
+    QHostAddress bindAddress;
     int netFamily, netTLS, netProto;
     quint16 netPort;
     UString netAddress, uriAddress, uriHost, publicName;
     QStringList localHosts, otherNames;
     mutable QMutex nameLock;
+    QAtomicPointer<const NameSet> localNames;  // published snapshot
+    QList<const NameSet *> retiredNames;    // freed when thread quiescent
+    QAtomicInt retiring;
     bool multiInterface;
-
-    const QStringList localnames() const;
-
-    static volatile unsigned instanceCount;
+    QAtomicInteger<quint64> drains, drained;    // batch statistics
+    QAtomicInteger<quint64> shed;       // requests refused when overloaded
+    Throttle throttle;                  // per source rate limits
+    EventPool *pool;                    // event data from this context
+    quint16 tracing;                    // context id in event traces
+
+    void publishNames();
+    void reclaimNames();
+    void resolve();
+    void setupEvents();
+    bool listenShared();
+    void wait(int timeout);
+    void deliver();
+
+    static QAtomicInt instanceCount;
     static QList<Context::Schema> Schemas;
     static QList<Context *> Contexts;
+    static QMutex ContextLock;
+    static QList<EventQueue *> Queues;
 
     ~Context() final;
 
     bool process(const Event& ev);
+    bool answer(const Event& ev, int code);
+    bool answer(const Reply& reply);
+    void keepalive(const Event& ev);
+    void busy(const Event& ev);
+    static int reachable(const UString& target);
+    bool post(const Reply& reply);
 
 signals:
-    void REQUEST_REGISTER(const Event& ev);
     void REQUEST_OPTIONS(const Event& ev);
     void SEND_MESSAGE(const Event& ev);
     void CALL_INVITE(const Event& ev);
@@ -156,6 +231,12 @@ private slots:
  * the stack's own thread context.  All low level access to exosip2 functions
  * will occur thru context member functions, as Context also supports eXosip
  * locking internally.
+ *
+ * On Linux the event thread blocks in epoll on the exosip event pipe and
+ * drains ready events in bounded batches.  Events for the stack go thru a
+ * lock-free per context queue, and stack replies are posted back to a
+ * mailbox the context sends from, or are sent directly by the caller when
+ * no eventfd wakeup is available.
  * \author David Sugar <tychosoft@gmail.com>
  */
 
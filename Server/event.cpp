@@ -16,19 +16,93 @@
  */
 
 #include "context.hpp"
+#include "trace.hpp"
 #include <QDebug>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
 
 #ifndef SESSION_EXPIRES
 #define SESSION_EXPIRES "session-expires"
 #endif
 
+namespace {
+    // custom headers we extract, in one pass over the header list
+    enum HeaderSlot : int {
+        AGENT_HEADER = 0,
+        SESSION_HEADER,
+        EXPIRES_HEADER,
+        LABEL_HEADER,
+        INITIALIZE_HEADER,
+        SUBJECT_HEADER,
+        MAX_HEADERS
+    };
+
+    constexpr char lowerCase(char ch) {
+        return (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch + ('a' - 'A')) : ch;
+    }
+
+    // fnv-1a of lowercase header or method name, usable for case labels
+    constexpr quint32 headerHash(const char *name, quint32 hash = 2166136261u) {
+        return *name ? headerHash(name + 1, (hash ^ static_cast<unsigned char>(lowerCase(*name))) * 16777619u) : hash;
+    }
+
+    int headerSlot(const char *name) {
+        const char *match;
+        int slot;
+
+        switch(headerHash(name)) {
+        case headerHash(USER_AGENT):
+            match = USER_AGENT;
+            slot = AGENT_HEADER;
+            break;
+        case headerHash(SESSION_EXPIRES):
+            match = SESSION_EXPIRES;
+            slot = SESSION_HEADER;
+            break;
+        case headerHash("expires"):
+            match = "expires";
+            slot = EXPIRES_HEADER;
+            break;
+        case headerHash("x-label"):
+            match = "x-label";
+            slot = LABEL_HEADER;
+            break;
+        case headerHash("x-initialize"):
+            match = "x-initialize";
+            slot = INITIALIZE_HEADER;
+            break;
+        case headerHash("subject"):
+            match = "subject";
+            slot = SUBJECT_HEADER;
+            break;
+        default:
+            return -1;
+        }
+
+        // a hash match may still be some other header...
+        if(osip_strcasecmp(name, match))
+            return -1;
+        return slot;
+    }
+
+    // a view of the header value, unless it has to be lowercased
+    UString lowerView(const char *value) {
+        for(auto cp = value; *cp; ++cp) {
+            if(*cp >= 'A' && *cp <= 'Z')
+                return UString(value).toLower();
+        }
+        return UString::view(value);
+    }
+}
+
 Event::Data::Data() :
-number(-1), expires(-1), status(0), hops(0), natted(false), local(false), associated(false), context(nullptr), event(nullptr), message(nullptr), authorization(nullptr)
+number(-1), expires(-1), status(0), hops(0), natted(false), local(false), associated(false), record(false), context(nullptr), event(nullptr), message(nullptr), authorization(nullptr), requestUri(nullptr), methodId(UNKNOWN), traceId(0xffff), allows(0), parsed(0)
 {
 }
 
 Event::Data::Data(eXosip_event_t *evt, Context *ctx) :
-number(-1), expires(-1), status(0), hops(0), natted(false), local(false), associated(false), context(ctx), event(evt), message(nullptr), authorization(nullptr)
+number(-1), expires(-1), status(0), hops(0), natted(false), local(false), associated(false), record(false), context(ctx), event(evt), message(nullptr), authorization(nullptr), requestUri(nullptr), methodId(UNKNOWN), traceId(ctx ? ctx->traceId() : 0xffff), allows(0), parsed(0)
 {
     // start time of event creation
     elapsed.start();
@@ -45,21 +119,21 @@ number(-1), expires(-1), status(0), hops(0), natted(false), local(false), associ
     case EXOSIP_REGISTRATION_SUCCESS:       // provider succeeded
     case EXOSIP_REGISTRATION_FAILURE:       // provider failed
         status = evt->response->status_code;
-        reason = evt->response->reason_phrase;
+        reason = UString::view(evt->response->reason_phrase);
         parseMessage(evt->response);
         break;
     case EXOSIP_MESSAGE_NEW:
     case EXOSIP_CALL_INVITE:
-        method = evt->request->sip_method;
+        method = UString::view(evt->request->sip_method);
+        methodId = Event::methodId(evt->request->sip_method);
         if(osip_message_get_authorization(evt->request, 0, &authorization) != 0 || !authorization->username || !authorization->response)
             authorization = nullptr;
         parseMessage(evt->request);
         if(evt->request->req_uri && evt->request->req_uri->host) {
             target = Contact(evt->request->req_uri);
-            char *uri = nullptr;
-            osip_uri_to_str(evt->request->req_uri, &uri);
-            if(uri)
-                request = uri;      // for consistent auth processing
+            osip_uri_to_str(evt->request->req_uri, &requestUri);
+            if(requestUri)
+                request = UString::view(requestUri);    // for consistent auth processing
             local = ctx->isLocal(target.host());
         }
         if(evt->request->to && evt->request->to->url && evt->request->to->url->username && ctx->isLocal(evt->request->to->url->host)) {
@@ -88,26 +162,25 @@ number(-1), expires(-1), status(0), hops(0), natted(false), local(false), associ
 Event::Data::~Data()
 {
     if(event) {
-        qDebug().nospace() << "~Event(" << event->type << ",cid=" << event->cid << ",did=" << event->did << ",ctx=" << context->objectName() << ",source=" << source.toString() << ")";
+        auto host = source.host();
+        Trace::event(elapsed.msecsSinceReference(), static_cast<qint32>(elapsed.elapsed()), event->type, event->cid, event->did, traceId, host.constData(), source.port());
         eXosip_event_free(event);
         event = nullptr;
     }
+    if(requestUri)
+        osip_free(requestUri);
 }
 
 void Event::Data::parseMessage(osip_message_t *msg)
 {
-    const osip_list_t& clist = msg->contacts;
-    const osip_list_t& vlist = msg->vias;
-    const osip_list_t& rlist = msg->record_routes;
-    const osip_list_t& alist = msg->allows;
-    int pos;
     Contact nat;
 
     message = msg;
     if(!msg)
         return;
 
-    pos = 0;
+    const osip_list_t& vlist = msg->vias;
+    int pos = 0;
     while(osip_list_eol(&vlist, pos) == 0) {
         auto via = static_cast<osip_via_t *>(osip_list_get(&vlist, pos++));
         ++hops;
@@ -139,58 +212,124 @@ void Event::Data::parseMessage(osip_message_t *msg)
         natted = true;
         source = nat;
     }
+}
+
+// the rest of the message is parsed on demand, under lock once per part...
+void Event::Data::parseLazy(int part) const
+{
+    QMutexLocker lock(&parseLock);
+    if(parsed.loadAcquire() & part)
+        return;
+
+    auto msg = message;
+    if(!msg) {
+        parsed.fetchAndOrRelease(part);
+        return;
+    }
+
+    switch(part) {
+    case HEADERS:
+        parseHeaders(msg);
+        break;
+    case ALLOWS:
+        parseAllows(msg);
+        break;
+    case CONTACTS:
+        parseContacts(msg);
+        break;
+    case ROUTES:
+        parseRoutes(msg);
+        break;
+    case PARTIES:
+        if(msg->from)
+            from = msg->from->url;
+        if(msg->to)
+            to = msg->to->url;
+        break;
+    case BODY:
+        parseBody(msg);
+        break;
+    default:
+        break;
+    }
+    parsed.fetchAndOrRelease(part);
+}
 
-    osip_header_t *header;
+void Event::Data::parseHeaders(osip_message_t *msg) const
+{
+    osip_header_t *found[MAX_HEADERS] = {nullptr};
+    const osip_list_t& hlist = msg->headers;
+    int pos = 0;
+
+    // first of each header wins, like osip_message_header_get_byname...
+    while(osip_list_eol(&hlist, pos) == 0) {
+        auto header = static_cast<osip_header_t *>(osip_list_get(&hlist, pos++));
+        if(!header || !header->hname)
+            continue;
+        auto slot = headerSlot(header->hname);
+        if(slot > -1 && !found[slot])
+            found[slot] = header;
+    }
 
-    header = nullptr;
-    osip_message_header_get_byname(msg, USER_AGENT, 0, &header);
+    auto header = found[AGENT_HEADER];
     if(header && header->hvalue)
-        agent = header->hvalue;
+        agent = UString::view(header->hvalue);
 
-    header = nullptr;
-    osip_message_header_get_byname(msg, SESSION_EXPIRES, 0, &header);
+    header = found[SESSION_HEADER];
     if(header && header->hvalue)
         expires = atoi(header->hvalue);
     else {
-        header = nullptr;
-        osip_message_header_get_byname(msg, "expires", 0, &header);
+        header = found[EXPIRES_HEADER];
         if(header && header->hvalue)
             expires = atoi(header->hvalue);
     }
 
-    header = nullptr;
-    osip_message_header_get_byname(msg, "x-label", 0, &header);
+    header = found[LABEL_HEADER];
     if(header && header->hvalue)
-        label = UString(header->hvalue).toLower();            
+        label = lowerView(header->hvalue);
     else
-        label = "NONE";
+        label = UString::view("NONE");
 
-    header = nullptr;
-    osip_message_header_get_byname(msg, "x-initialize", 0, &header);
+    header = found[INITIALIZE_HEADER];
     if(header && header->hvalue)
-        initialize = UString(header->hvalue).toLower();
+        initialize = lowerView(header->hvalue);
 
-    header = nullptr;
-    osip_message_header_get_byname(msg, "subject", 0, &header);
+    header = found[SUBJECT_HEADER];
     if(header && header->hvalue)
-        subject = header->hvalue;
-
+        subject = UString::view(header->hvalue);
+}
 
-    pos = 0;
+void Event::Data::parseAllows(osip_message_t *msg) const
+{
+    const osip_list_t& alist = msg->allows;
+    int pos = 0;
     while(osip_list_eol(&alist, pos) == 0) {
         auto allow = static_cast<osip_allow_t *>(osip_list_get(&alist, pos++));
-        if(allow && allow->value)
-            allows << UString(allow->value).toLower();
+        if(!allow || !allow->value)
+            continue;
+        auto id = Event::methodId(allow->value);
+        if(id)
+            allows |= id;
+        else
+            otherAllows << UString(allow->value).toLower();
     }
+}
 
-    pos = 0;
+void Event::Data::parseContacts(osip_message_t *msg) const
+{
+    const osip_list_t& clist = msg->contacts;
+    int pos = 0;
     while(osip_list_eol(&clist, pos) == 0) {
         auto contact = static_cast<osip_contact_t *>(osip_list_get(&clist, pos++));
         if(contact && contact->url && contact->url->host)
             contacts << Contact(contact);
     }
+}
 
-    pos = 0;
+void Event::Data::parseRoutes(osip_message_t *msg) const
+{
+    const osip_list_t& rlist = msg->record_routes;
+    int pos = 0;
     while(osip_list_eol(&rlist, pos) == 0) {
         auto recroute = static_cast<osip_record_route_t*>(osip_list_get(&rlist, pos++));
         if(recroute->url && recroute->url->host) {
@@ -211,22 +350,217 @@ void Event::Data::parseMessage(osip_message_t *msg)
             }
         }
     }
+}
 
-    if(msg->from)
-        from = msg->from->url;
-    if(msg->to)
-        to = msg->to->url;
-
+void Event::Data::parseBody(osip_message_t *msg) const
+{
     if(msg->content_type && msg->content_type->type) {
-        content = msg->content_type->type;
         if(msg->content_type->subtype)
-            content += UString("/") + msg->content_type->subtype;
+            content = UString(msg->content_type->type) + "/" + msg->content_type->subtype;
+        else
+            content = UString::view(msg->content_type->type);
     }
 
     osip_body_t *data = nullptr;
     osip_message_get_body(msg, 0, &data);
     if(data && data->length)
-        body = QByteArray(data->body, static_cast<int>(data->length));
+        body = QByteArray::fromRawData(data->body, static_cast<int>(data->length));
+}
+
+EventPool::EventPool(size_t size) :
+blockSize(offset() + size), allocated(0), local(nullptr), remote(nullptr), outstanding(1)
+{
+}
+
+EventPool::~EventPool()
+{
+    auto list = remote.fetchAndStoreAcquire(nullptr);
+    while(list) {
+        auto next = list->next;
+        ::free(list);
+        list = next;
+    }
+    while(local) {
+        auto next = local->next;
+        ::free(local);
+        local = next;
+    }
+}
+
+size_t EventPool::offset()
+{
+    const size_t align = alignof(std::max_align_t);
+    return (sizeof(Block) + align - 1) & ~(align - 1);
+}
+
+EventPool::Block *EventPool::header(void *mem)
+{
+    return reinterpret_cast<Block *>(static_cast<char *>(mem) - offset());
+}
+
+// owner thread only, takes back remote frees all at once when empty...
+void *EventPool::alloc()
+{
+    if(!local)
+        local = remote.fetchAndStoreAcquire(nullptr);
+
+    auto block = local;
+    if(block)
+        local = block->next;
+    else {
+        block = static_cast<Block *>(::malloc(blockSize));
+        if(!block)
+            throw std::bad_alloc();
+        ++allocated;
+    }
+    block->pool = this;
+    block->next = nullptr;
+    outstanding.ref();
+    return reinterpret_cast<char *>(block) + offset();
+}
+
+void EventPool::release(void *mem)
+{
+    auto block = header(mem);
+    auto pool = block->pool;
+
+    if(!pool) {
+        ::free(block);
+        return;
+    }
+
+    auto top = pool->remote.loadAcquire();
+    do {
+        block->next = top;
+    } while(!pool->remote.testAndSetOrdered(top, block, top));
+
+    if(!pool->outstanding.deref())
+        delete pool;
+}
+
+// context is done with the pool, last block back frees it
+void EventPool::retire()
+{
+    if(!outstanding.deref())
+        delete this;
+}
+
+// blocks without a pool, such as empty events, come from the heap
+void *EventPool::allocate(size_t size)
+{
+    auto block = static_cast<Block *>(::malloc(offset() + size));
+    if(!block)
+        throw std::bad_alloc();
+    block->pool = nullptr;
+    block->next = nullptr;
+    return reinterpret_cast<char *>(block) + offset();
+}
+
+void *Event::Data::operator new(size_t size)
+{
+    return EventPool::allocate(size);
+}
+
+void *Event::Data::operator new(size_t size, EventPool *pool)
+{
+    if(!pool)
+        return EventPool::allocate(size);
+    return pool->alloc();
+}
+
+void Event::Data::operator delete(void *mem)
+{
+    if(mem)
+        EventPool::release(mem);
+}
+
+void Event::Data::operator delete(void *mem, EventPool *pool)
+{
+    Q_UNUSED(pool);
+    operator delete(mem);
+}
+
+Event::Method Event::methodId(const char *name)
+{
+    if(!name)
+        return UNKNOWN;
+
+    const char *match;
+    Method id;
+
+    switch(headerHash(name)) {
+    case headerHash("invite"):
+        match = "invite";
+        id = INVITE;
+        break;
+    case headerHash("ack"):
+        match = "ack";
+        id = ACK;
+        break;
+    case headerHash("options"):
+        match = "options";
+        id = OPTIONS;
+        break;
+    case headerHash("bye"):
+        match = "bye";
+        id = BYE;
+        break;
+    case headerHash("cancel"):
+        match = "cancel";
+        id = CANCEL;
+        break;
+    case headerHash("register"):
+        match = "register";
+        id = REGISTER;
+        break;
+    case headerHash("subscribe"):
+        match = "subscribe";
+        id = SUBSCRIBE;
+        break;
+    case headerHash("notify"):
+        match = "notify";
+        id = NOTIFY;
+        break;
+    case headerHash("refer"):
+        match = "refer";
+        id = REFER;
+        break;
+    case headerHash("message"):
+        match = "message";
+        id = MESSAGE;
+        break;
+    case headerHash("info"):
+        match = "info";
+        id = INFO;
+        break;
+    case headerHash("prack"):
+        match = "prack";
+        id = PRACK;
+        break;
+    case headerHash("update"):
+        match = "update";
+        id = UPDATE;
+        break;
+    case headerHash("publish"):
+        match = "publish";
+        id = PUBLISH;
+        break;
+    case headerHash("ping"):
+        match = "ping";
+        id = PING;
+        break;
+    default:
+        return UNKNOWN;
+    }
+
+    if(osip_strcasecmp(name, match))
+        return UNKNOWN;
+    return id;
+}
+
+EventPool *Event::createPool()
+{
+    return new EventPool(sizeof(Event::Data));
 }
 
 Event::Event()
@@ -236,7 +570,7 @@ Event::Event()
 
 Event::Event(eXosip_event_t *evt, Context *ctx)
 {
-    d = new Event::Data(evt, ctx);
+    d = new(ctx ? ctx->eventPool() : nullptr) Event::Data(evt, ctx);
 }
 
 Event::Event(const Event& copy) :
@@ -277,6 +611,7 @@ const UString Event::uriContext(const UString& username) const
 // used for events that support only one contact object...
 const Contact Event::contact() const
 {
+    d->parse(Data::CONTACTS);
     if(d->contacts.size() != 1)
         return Contact();
     return d->contacts[0];
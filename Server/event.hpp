@@ -21,6 +21,7 @@
 #include "../Common/compiler.hpp"
 #include "../Common/util.hpp"
 #include "../Common/contact.hpp"
+#include "../Common/inline.hpp"
 
 #include <QThread>
 #include <QMutex>
@@ -29,12 +30,70 @@
 #include <QAbstractSocket>
 #include <QSharedData>
 #include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QAtomicPointer>
 
 class Context;
 
+class EventPool final
+{
+    Q_DISABLE_COPY(EventPool)
+public:
+    explicit EventPool(size_t size);
+
+    void *alloc();
+    void retire();
+
+    inline unsigned blocks() const {
+        return allocated;
+    }
+
+    static void *allocate(size_t size);
+    static void release(void *mem);
+
+private:
+    typedef struct Block {
+        EventPool *pool;                // owner, or nullptr if from heap
+        struct Block *next;             // next free block
+    } Block;
+
+    size_t blockSize;
+    unsigned allocated;
+    Block *local;                       // owner thread free list
+    QAtomicPointer<Block> remote;       // blocks freed by other threads
+    QAtomicInt outstanding;             // blocks in use, +1 for owner
+
+    ~EventPool();
+
+    static Block *header(void *mem);
+    static size_t offset();
+};
+
 class Event final
 {
 public:
+    enum Method : quint32 {
+        UNKNOWN =   0,
+        INVITE =    1<<0,
+        ACK =       1<<1,
+        OPTIONS =   1<<2,
+        BYE =       1<<3,
+        CANCEL =    1<<4,
+        REGISTER =  1<<5,
+        SUBSCRIBE = 1<<6,
+        NOTIFY =    1<<7,
+        REFER =     1<<8,
+        MESSAGE =   1<<9,
+        INFO =      1<<10,
+        PRACK =     1<<11,
+        UPDATE =    1<<12,
+        PUBLISH =   1<<13,
+        PING =      1<<14,
+    };
+
+    typedef Util::SmallVector<Contact, 1> Contacts;     // usually one
+    typedef Util::SmallVector<Contact, 2> Routes;       // usually none
+
     Event();
     Event(eXosip_event_t *evt, Context *ctx);
     Event(const Event& copy);
@@ -61,15 +120,18 @@ public:
         return d->context;
     }
 
-    inline const QList<Contact>& contacts() const {
+    inline const Contacts& contacts() const {
+        d->parse(Data::CONTACTS);
         return d->contacts;
     }
 
-    inline const QList<Contact>& routes() const {
+    inline const Routes& routes() const {
+        d->parse(Data::ROUTES);
         return d->routes;
     }
 
     inline int expires() const {
+        d->parse(Data::HEADERS);
         return d->expires;
     }
 
@@ -78,6 +140,7 @@ public:
     }
 
     inline const UString agent() const {
+        d->parse(Data::HEADERS);
         return d->agent;
     }
 
@@ -89,11 +152,16 @@ public:
         return d->method;
     }
 
+    inline Method methodId() const {
+        return d->methodId;
+    }
+
     inline int hops() const {
         return d->hops;
     }
 
     inline bool record() const {
+        d->parse(Data::ROUTES);
         return d->record;
     }
 
@@ -130,10 +198,12 @@ public:
     }
 
     inline const Contact from() const {
+        d->parse(Data::PARTIES);
         return d->from;
     }
 
     inline const Contact to() const {
+        d->parse(Data::PARTIES);
         return d->to;
     }
 
@@ -170,18 +240,22 @@ public:
     }
 
     inline const QByteArray body() const {
+        d->parse(Data::BODY);
         return d->body;
     }
 
     inline const UString content() const {
+        d->parse(Data::BODY);
         return d->content;
     }
 
     inline const UString subject() const {
+        d->parse(Data::HEADERS);
         return d->subject;
     }
 
     inline const UString initialize() const {
+        d->parse(Data::HEADERS);
         return d->initialize;
     }
 
@@ -209,11 +283,22 @@ public:
         return d->elapsed.elapsed();
     }
 
-    inline QList<UString> allows() const {
+    inline quint32 allows() const {
+        d->parse(Data::ALLOWS);
         return d->allows;
     }
 
+    inline bool isAllowed(quint32 methods) const {
+        return (allows() & methods) == methods;
+    }
+
+    inline const QList<UString> otherAllows() const {
+        d->parse(Data::ALLOWS);
+        return d->otherAllows;
+    }
+
     inline UString label() const {
+        d->parse(Data::HEADERS);
         return d->label;
     }
 
@@ -224,34 +309,75 @@ public:
     const UString text() const;
     const UString uri(const Contact &addr) const;
 
+    static EventPool *createPool();
+    static Method methodId(const char *name);
+
 private:
     class Data final : public QSharedData
 	{
         Q_DISABLE_COPY(Data)        // can never deep copy...
 	public:
+        enum : int {
+            HEADERS = 1<<0,         // agent, expires, label, subject...
+            ALLOWS = 1<<1,
+            CONTACTS = 1<<2,
+            ROUTES = 1<<3,
+            PARTIES = 1<<4,         // from and to
+            BODY = 1<<5,            // content type and body
+        };
+
         Data();
         Data(eXosip_event_t *evt, Context *ctx);
         ~Data();
 
+        static void *operator new(size_t size);
+        static void *operator new(size_t size, EventPool *pool);
+        static void operator delete(void *mem);
+        static void operator delete(void *mem, EventPool *pool);
+
         int number;                 // referencing extension # or -1
-        int expires;                // longest expiration
+        mutable int expires;        // longest expiration
         int status;
         int hops;                   // via hops
-        bool natted, local, associated, record;
+        bool natted, local, associated;
+        mutable bool record;
         Context *context;
         eXosip_event_t *event;
         osip_message_t *message;
         osip_authorization_t *authorization;
-        QList<Contact> contacts, routes;
-        UString agent, method, subject, text, content, realm, reason, initialize;
-        UString userid, nonce, digest, algorithm, label, request;
+        char *requestUri;           // owned, request is a view of it
+        mutable Contacts contacts;
+        mutable Routes routes;
+        mutable UString agent, subject, content, initialize, label;
+        UString method, text, realm, reason;
+        UString userid, nonce, digest, algorithm, request;
         Contact source;  // if nat, has first nat
-        Contact from, to, target;
-        QList<UString> allows;
-        QByteArray body;
+        mutable Contact from, to;
+        Contact target;
+        Method methodId;            // request method bit
+        quint16 traceId;            // context may be gone when traced
+        mutable quint32 allows;     // allowed method bits
+        mutable QList<UString> otherAllows;     // unknown, lowercase
+        mutable QByteArray body;
         QElapsedTimer elapsed;
 
+        // parse a part of the message the first time it is asked for
+        inline void parse(int part) const {
+            if(!(parsed.loadAcquire() & part))
+                parseLazy(part);
+        }
+
+    private:
+        mutable QAtomicInt parsed;
+        mutable QMutex parseLock;
+
         void parseMessage(osip_message_t *msg);
+        void parseLazy(int part) const;
+        void parseHeaders(osip_message_t *msg) const;
+        void parseAllows(osip_message_t *msg) const;
+        void parseContacts(osip_message_t *msg) const;
+        void parseRoutes(osip_message_t *msg) const;
+        void parseBody(osip_message_t *msg) const;
     };
 
     QSharedDataPointer<Event::Data> d;
@@ -269,6 +395,14 @@ Q_DECLARE_METATYPE(Event)
  * \file event.hpp
  */
 
+/*!
+ * \class EventPool
+ * \brief Per context pool of event data blocks.
+ * Blocks are taken by the owning context thread, and may be returned from
+ * any thread thru a lock-free stack.
+ * \author David Sugar <tychosoft@gmail.com>
+ */
+
 /*!
  * \class Event
  * \brief Container for SIP Events.
@@ -278,11 +412,9 @@ Q_DECLARE_METATYPE(Event)
  * slots.  Exosip2 memory management for these data structures will also
  * be buried inside here.
  *
- * A lot of computation and parsing for lists, to determine nat and source
- * address, contacts, etc, happens in the constructor automatically for 
- * every event.  The event object is constructed in each Context thread 
- * before handed off; this maximizes compute in parallel listeners rather
- * than in bottlenecks like the stack manager thread.
+ * Vias and the request target are parsed in the constructor, and other
+ * parts of the message the first time they are asked for.  String fields
+ * are views into the osip message, so must be copied to outlive the event.
  * \author David Sugar <tychosoft@gmail.com>
  *
  * \fn Event::contacts()
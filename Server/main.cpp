@@ -70,6 +70,7 @@ int main(int argc, char **argv)
         {{"H", "host", "public"}, "Specify public host name", "host", "%%host"},
         {{"N", "network", "domain"}, "Specify network domain to serve", "name", "%%network"},
         {{"P", "port"}, "Specify network port to bind", "100-65534", "%%port"},
+        {{"W", "workers"}, "Specify udp worker threads per port", "1-64", "%%workers"},
         {Args::HelpArgument},
         {Args::VersionArgument},
         {{"c", "config"}, "Specify config file", "file", SERVICE_CONF},
@@ -91,7 +92,9 @@ int main(int argc, char **argv)
         {CURRENT_HOSTNAME,  "--host"},
         {CURRENT_PORT,      "--port"},
         {CURRENT_ADDRESS,   "--address"},
+        {CURRENT_WORKERS,   "--workers"},
         {DEFAULT_PORT,      5060},
+        {DEFAULT_WORKERS,   1},
         {DEFAULT_HOSTNAME,  QHostInfo::localHostName()},
         {DEFAULT_ADDRESS,   "any"},
         {DEFAULT_NETWORK,   Util::localDomain()},
@@ -104,6 +107,10 @@ int main(int argc, char **argv)
     if(port < 100 || port > 65534 || port % 2)
         crit(95) << port << ": invalid sip port value";
 
+    auto workers = server[CURRENT_WORKERS].toUInt();
+    if(workers < 1 || workers > 64)
+        crit(95) << workers << ": invalid worker count";
+
     auto interfaces = Util::bindAddress(server[CURRENT_ADDRESS]);
     if(interfaces.count() < 1)
         crit(95) << "no valid interfaces specified";
@@ -120,7 +127,7 @@ int main(int argc, char **argv)
 
     unsigned mask = Context::UDP | Context::TCP | Context::Allow::REGISTRY | Context::Allow::REMOTE;
 
-    Manager::create(interfaces, port, mask);
+    Manager::create(interfaces, port, mask, workers);
 
     // create managers and start server...
     Database::init(2);
@@ -22,6 +22,25 @@
 #include "main.hpp"
 
 #include <QUuid>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QMessageAuthenticationCode>
+#include <ctime>
+
+#if defined(Q_OS_LINUX)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#define OVERLOAD_QUEUE      2000    // events waiting for the stack
+#define OVERLOAD_AUTHORIZE  200     // endpoint lookups in authorize
+#define OVERLOAD_REQUESTS   500     // pending database requests
+#define OVERLOAD_RETRY      5       // base retry after seconds
+#define NONCE_LIFETIME      300     // seconds a challenge stays valid
+#define NONCE_SKEW          5       // seconds of clock skew between nodes
+#define NONCE_DIGEST        16      // bytes of hmac kept in a nonce
+#define CREDENTIAL_CACHE    10000   // secrets kept for refreshes
+#define CREDENTIAL_TTL      900     // seconds a cached secret is trusted
 
 Manager *Manager::Instance = nullptr;
 UString Manager::ServerMode;
@@ -30,12 +49,69 @@ UString Manager::ServerRealm;
 QStringList Manager::ServerAliases;
 QStringList Manager::ServerNames;
 unsigned Manager::Contexts = 0;
+QAtomicInt Manager::Ringing(0);
+int Manager::Doorbell = -1;
+QAtomicInt Manager::Queued(0);
+QAtomicInt Manager::Authorizing(0);
+QAtomicInt Manager::QueueLimit(OVERLOAD_QUEUE);
+QAtomicInt Manager::AuthorizeLimit(OVERLOAD_AUTHORIZE);
+QAtomicInt Manager::RequestLimit(OVERLOAD_REQUESTS);
+QAtomicInt Manager::RetryAfter(OVERLOAD_RETRY);
+QMutex Manager::NonceLock;
+QByteArray Manager::NonceKey;
+QByteArray Manager::PriorKey;
+QAtomicInt Manager::NonceLifetime(NONCE_LIFETIME);
+QAtomicInteger<quint64> Manager::CredentialHits(0);
+QAtomicInteger<quint64> Manager::CredentialMisses(0);
+
+// nonces are signed with a key for the lifetime sized epoch they were
+// issued in, so the signing key rotates without any shared state...
+static const QByteArray nonceDigest(const QByteArray& secret, const QByteArray& stamp, const UString& realm, const UString& source, int lifetime)
+{
+    auto epoch = stamp.toUInt(nullptr, 16) / static_cast<quint32>(lifetime);
+    auto key = QMessageAuthenticationCode::hash(QByteArray::number(epoch), secret, QCryptographicHash::Sha256);
+
+    QMessageAuthenticationCode mac(QCryptographicHash::Sha256, key);
+    mac.addData(stamp);
+    mac.addData(":", 1);
+    mac.addData(realm);
+    mac.addData(":", 1);
+    mac.addData(source);
+    return mac.result().left(NONCE_DIGEST).toHex();
+}
+
+// compare without leaking where a forged nonce first differs...
+static bool sameDigest(const QByteArray& a, const QByteArray& b)
+{
+    if(a.length() != b.length())
+        return false;
+
+    char diff = 0;
+    for(int pos = 0; pos < a.length(); ++pos)
+        diff |= a[pos] ^ b[pos];
+    return diff == 0;
+}
 
-Manager::Manager(unsigned order)
+Manager::Manager(unsigned order) :
+credentials(CREDENTIAL_CACHE), credentialTimeout(CREDENTIAL_TTL * 1000l)
 {
     qRegisterMetaType<Event>("Event");
     qRegisterMetaType<UString>("UString");
 
+#if defined(Q_OS_LINUX)
+    // notifier is our child, so it moves with us to the stack thread...
+    Doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(Doorbell > -1) {
+        auto notifier = new QSocketNotifier(Doorbell, QSocketNotifier::Read, this);
+        connect(notifier, SIGNAL(activated(int)), this, SLOT(drainEvents()));
+    }
+#endif
+
+    // timer is our child too, and is restarted in the stack thread...
+    auto timer = new QTimer(this);
+    connect(timer, SIGNAL(timeout()), this, SLOT(runTimers()));
+    timer->start(TimerWheel::tick());
+
     moveToThread(Server::createThread("stack", order));
 #ifndef Q_OS_WIN
     osip_trace_initialize_syslog(TRACE_LEVEL0, const_cast<char *>("sipwitchqt"));
@@ -46,6 +122,7 @@ Manager::Manager(unsigned order)
 
     connect(thread(), &QThread::finished, this, &QObject::deleteLater);
     connect(server, &Server::changeConfig, this, &Manager::applyConfig);
+    connect(db, &Database::updateAuthorize, this, &Manager::flushCredentials);
 
 #ifndef QT_NO_DEBUG
     connect(db, &Database::countResults, this, &Manager::reportCounts);
@@ -54,6 +131,12 @@ Manager::Manager(unsigned order)
 
 Manager::~Manager()
 {
+#if defined(Q_OS_LINUX)
+    if(Doorbell > -1) {
+        ::close(Doorbell);
+        Doorbell = -1;
+    }
+#endif
     Instance = nullptr;
 }
 
@@ -84,6 +167,36 @@ void Manager::applyConfig(const QVariantHash& config)
     ServerNames = config["localnames"].toStringList();
     QString hostname = config["host"].toString();
     QString realm = config["realm"].toString();
+    int limit;
+
+    Throttle::applyConfig(config);
+
+    limit = config.value("overload/queue", OVERLOAD_QUEUE).toInt();
+    QueueLimit.storeRelease(limit > 0 ? limit : OVERLOAD_QUEUE);
+    limit = config.value("overload/authorize", OVERLOAD_AUTHORIZE).toInt();
+    AuthorizeLimit.storeRelease(limit > 0 ? limit : OVERLOAD_AUTHORIZE);
+    limit = config.value("overload/requests", OVERLOAD_REQUESTS).toInt();
+    RequestLimit.storeRelease(limit > 0 ? limit : OVERLOAD_REQUESTS);
+    limit = config.value("overload/retry", OVERLOAD_RETRY).toInt();
+    RetryAfter.storeRelease(limit > 0 ? limit : OVERLOAD_RETRY);
+    limit = config.value("nonce/lifetime", NONCE_LIFETIME).toInt();
+    NonceLifetime.storeRelease(limit > 0 ? limit : NONCE_LIFETIME);
+    limit = config.value("credentials/cache", CREDENTIAL_CACHE).toInt();
+    credentials.setMaxCost(limit > 0 ? limit : CREDENTIAL_CACHE);
+    limit = config.value("credentials/ttl", CREDENTIAL_TTL).toInt();
+    credentialTimeout = (limit > 0 ? limit : CREDENTIAL_TTL) * 1000l;
+
+    // nodes sharing a secret derive the same epoch keys from it...
+    auto secret = config.value("nonce/secret").toString();
+    if(secret.isEmpty())
+        secret = Server::uuid();
+    auto key = QCryptographicHash::hash("nonce:" + secret.toUtf8(), QCryptographicHash::Sha256);
+    NonceLock.lock();
+    if(key != NonceKey) {
+        PriorKey = NonceKey;
+        NonceKey = key;
+    }
+    NonceLock.unlock();
 
     if(realm.isEmpty()) {
         realm = Server::sym(CURRENT_NETWORK);
@@ -97,6 +210,8 @@ void Manager::applyConfig(const QVariantHash& config)
     if(realm != ServerRealm) {
         ServerRealm = realm;
         info() << "entering realm " << ServerRealm;
+        Registry::changeRealm(ServerRealm);
+        flushCredentials();
         emit changeRealm(ServerRealm);
     }
     applyNames();
@@ -110,23 +225,141 @@ const QByteArray Manager::computeDigest(const UString& id, const UString& secret
     return QCryptographicHash::hash(id + ":" + realm() + ":" + secret, digest);
 }
 
-void Manager::create(const QHostAddress& addr, quint16 port, unsigned mask)
+const UString Manager::nonce(const UString& realm, const Contact& source)
+{
+    auto stamp = QByteArray::number(static_cast<quint32>(time(nullptr)), 16).rightJustified(8, '0');
+    NonceLock.lock();
+    auto key = NonceKey;
+    NonceLock.unlock();
+    return stamp + nonceDigest(key, stamp, realm, source.host(), NonceLifetime.loadAcquire());
+}
+
+// a nonce we issued that has only aged out is stale rather than invalid
+Manager::NonceState Manager::checkNonce(const UString& nonce, const UString& realm, const Contact& source)
+{
+    if(nonce.length() != 8 + NONCE_DIGEST * 2)
+        return INVALID_NONCE;
+
+    bool valid = false;
+    auto stamp = nonce.left(8);
+    auto issued = stamp.toUInt(&valid, 16);
+    if(!valid)
+        return INVALID_NONCE;
+
+    NonceLock.lock();
+    auto key = NonceKey;
+    auto prior = PriorKey;
+    NonceLock.unlock();
+
+    // the stamp picks the epoch key, so only nonces from the current or
+    // previous epoch are young enough to be valid, older ones are stale...
+    auto lifetime = NonceLifetime.loadAcquire();
+    auto digest = nonce.mid(8);
+    if(!sameDigest(digest, nonceDigest(key, stamp, realm, source.host(), lifetime)) &&
+      (prior.isEmpty() || !sameDigest(digest, nonceDigest(prior, stamp, realm, source.host(), lifetime))))
+        return INVALID_NONCE;
+
+    auto age = static_cast<qint32>(static_cast<quint32>(time(nullptr)) - issued);
+    if(age < -NONCE_SKEW || age > lifetime)
+        return STALE_NONCE;
+    return VALID_NONCE;
+}
+
+void Manager::create(const QHostAddress& addr, quint16 port, unsigned mask, unsigned workers)
 {
     unsigned index = ++Contexts;
 
-    debug() << "Creating sip" << index << ": bind=" <<  addr.toString() << ", port=" << port << ", mask=" << QString("0x%1").arg(mask, 8, 16, QChar('0'));
+    if(workers > 1 && !Context::canShare()) {
+        warning() << "Shared ports unsupported, using one worker";
+        workers = 1;
+    }
+
+    debug() << "Creating sip" << index << ": bind=" <<  addr.toString() << ", port=" << port << ", mask=" << QString("0x%1").arg(mask, 8, 16, QChar('0')) << ", workers=" << workers;
 
     foreach(auto schema, Context::schemas()) {
-        if(schema.proto & mask) {
-            new Context(addr, port, schema, mask, index);
+        if(!(schema.proto & mask))
+            continue;
+
+        // udp workers share the port, kernel hashes each source to one...
+        if(schema.proto == Context::UDP && workers > 1) {
+            for(unsigned worker = 0; worker < workers; ++worker)
+                new Context(addr, port, schema, mask, index, static_cast<int>(worker));
         }
+        else
+            new Context(addr, port, schema, mask, index);
     }
 }
 
-void Manager::create(const QList<QHostAddress>& list, quint16 port, unsigned  mask)
+void Manager::create(const QList<QHostAddress>& list, quint16 port, unsigned  mask, unsigned workers)
 {
     foreach(auto host, list) {
-        create(host, port, mask);
+        create(host, port, mask, workers);
+    }
+}
+
+// called from context threads after queuing events, rings once till drained
+void Manager::wakeup()
+{
+    if(!Ringing.testAndSetOrdered(0, 1))
+        return;
+
+#if defined(Q_OS_LINUX)
+    quint64 kick = 1;
+    if(Doorbell > -1 && ::write(Doorbell, &kick, sizeof(kick)) == sizeof(kick))
+        return;
+#endif
+    QMetaObject::invokeMethod(Instance, "drainEvents", Qt::QueuedConnection);
+}
+
+void Manager::drainEvents()
+{
+#if defined(Q_OS_LINUX)
+    quint64 rung;
+    if(Doorbell > -1 && ::read(Doorbell, &rung, sizeof(rung)) < 0)
+        rung = 0;
+#endif
+
+    // clear before draining so a push after this point rings again...
+    Ringing.fetchAndStoreOrdered(0);
+
+    Event event;
+    int count = 0;
+    foreach(auto queue, Context::queues()) {
+        while(queue->pull(event)) {
+            ++count;
+            dispatch(event);
+        }
+    }
+    Queued.fetchAndAddRelaxed(-count);
+}
+
+void Manager::runTimers()
+{
+    wheel.advance();
+}
+
+void Manager::flushCredentials()
+{
+    qDebug() << "Flushing credentials" << credentials.count() << "hits" << CredentialHits.load() << "misses" << CredentialMisses.load();
+    credentials.clear();
+}
+
+// spread retries from shed requests so they do not return all at once
+int Manager::retryAfter()
+{
+    auto base = RetryAfter.loadAcquire();
+    return base + static_cast<int>(osip_build_random_number() % static_cast<unsigned>(base + 1));
+}
+
+void Manager::dispatch(const Event& event)
+{
+    switch(event.type()) {
+    case EXOSIP_MESSAGE_NEW:
+        if(MSG_IS_REGISTER(event.message()))
+            refreshRegistration(event);
+        break;
+    default:
+        break;
     }
 }
 
@@ -137,27 +370,67 @@ void Manager::refreshRegistration(const Event &ev)
         return;
     }
     auto *reg = Registry::find(ev);
-    if(reg) {
-        if(!ev.authorization())
-            Context::challenge(ev, reg);
-        else
-            Context::reply(ev, reg->authorize(ev));
+    if(reg && !ev.authorization()) {
+        Context::challenge(ev, reg);
+        return;
     }
-    else
-        emit findEndpoint(ev);
+
+    // a refresh whose secret we still hold needs no authorize lookup, but
+    // secrets are re-checked after a while as rows may have changed...
+    auto secret = reg ? credentials.object(Credential(reg)) : nullptr;
+    if(secret && secret->cached.hasExpired(credentialTimeout)) {
+        credentials.remove(Credential(reg));
+        secret = nullptr;
+    }
+    if(secret) {
+        ++CredentialHits;
+        authorizeRegistration(ev, reg, secret->digest);
+        return;
+    }
+
+    if(reg)
+        ++CredentialMisses;
+    Authorizing.ref();
+    emit findEndpoint(ev);
 }
 
 void Manager::createRegistration(const Event& event, const QVariantHash& endpoint)
 {
     if(endpoint.isEmpty()) {
         Context::reply(event, SIP_NOT_FOUND);
+        return;
     }
-    else {
-        Registry *reg = new Registry(endpoint);
-        if(!reg)
-            Context::reply(event, SIP_INTERNAL_SERVER_ERROR);
-        else
-            Context::challenge(event, reg);
+
+    auto reg = Registry::find(event);
+    if(!reg)
+        reg = new Registry(endpoint);
+    if(!reg) {
+        Context::reply(event, SIP_INTERNAL_SERVER_ERROR);
+        return;
     }
+
+    // plain secrets are hashed into the ha1 digest verify() expects...
+    UString secret = endpoint.value("secret").toString();
+    auto format = endpoint.value("digest").toString().toUpper();
+    if(!secret.isEmpty() && (format.isEmpty() || format == "NONE"))
+        secret = QCryptographicHash::hash(reg->authorizeId() + ":" + reg->realm() + ":" + secret, reg->algorithm()).toHex();
+    auto cached = new Secret;
+    cached->digest = secret;
+    cached->cached.start();
+    credentials.insert(Credential(reg), cached);
+    if(!event.authorization())
+        Context::challenge(event, reg);
+    else
+        authorizeRegistration(event, reg, secret);
+}
+
+void Manager::authorizeRegistration(const Event& ev, Registry *reg, const UString& secret)
+{
+    auto stale = false;
+    auto result = reg->authorize(ev, secret, stale);
+    if(result == SIP_UNAUTHORIZED)
+        Context::challenge(ev, reg, stale);
+    else
+        Context::reply(ev, result);
 }
 
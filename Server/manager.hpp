@@ -21,7 +21,11 @@
 #include "../Common/compiler.hpp"
 #include "../Database/authorize.hpp"
 #include "invite.hpp"
+#include "timer.hpp"
 #include <QMutex>
+#include <QAtomicInt>
+#include <QCache>
+#include <QElapsedTimer>
 #include <QCryptographicHash>
 
 class Manager final : public QObject
@@ -30,6 +34,8 @@ class Manager final : public QObject
     Q_DISABLE_COPY(Manager)
 
 public:
+    typedef enum { VALID_NONCE, STALE_NONCE, INVALID_NONCE } NonceState;
+
     inline static Manager *instance() {
         Q_ASSERT(Instance != nullptr);
         return Instance;
@@ -40,11 +46,67 @@ public:
     }
 
     static const QByteArray computeDigest(const UString &id, const UString &secret, QCryptographicHash::Algorithm digest = QCryptographicHash::Md5);
-    static void create(const QList<QHostAddress>& list, quint16 port, unsigned mask);
-    static void create(const QHostAddress& addr, quint16 port, unsigned mask);
+    static const UString nonce(const UString& realm, const Contact& source);
+    static NonceState checkNonce(const UString& nonce, const UString& realm, const Contact& source);
+    static void create(const QList<QHostAddress>& list, quint16 port, unsigned mask, unsigned workers = 1);
+    static void create(const QHostAddress& addr, quint16 port, unsigned mask, unsigned workers = 1);
     static void init(unsigned order);
+    static void wakeup();
+    static int retryAfter();
+
+    inline static quint64 credentialHits() {
+        return CredentialHits.load();
+    }
+
+    inline static quint64 credentialMisses() {
+        return CredentialMisses.load();
+    }
+
+    inline static TimerWheel& timers() {
+        Q_ASSERT(Instance != nullptr);
+        return Instance->wheel;
+    }
+
+    inline static void queued(int count) {
+        Queued.fetchAndAddRelaxed(count);
+    }
+
+    inline static void authorized() {
+        Authorizing.deref();
+    }
+
+    // admission control for new requests, checked from context threads
+    inline static bool isOverloaded() {
+        return Queued.loadAcquire() > QueueLimit.loadAcquire() ||
+            Authorizing.loadAcquire() > AuthorizeLimit.loadAcquire() ||
+            Request::pending() > RequestLimit.loadAcquire();
+    }
 
 private:
+    class Credential final
+    {
+    public:
+        explicit Credential(const Registry *reg) :
+        user(reg->authorizeId()), realm(reg->realm()), digest(reg->digest()) {}
+
+        bool operator==(const Credential& other) const {
+            return digest == other.digest && user == other.user && realm == other.realm;
+        }
+
+    private:
+        UString user, realm;
+        Registry::Digest digest;
+
+        friend uint qHash(const Credential& key, uint seed) {
+            return qHash(key.user, seed) ^ qHash(key.realm, seed) ^ static_cast<uint>(key.digest);
+        }
+    };
+
+    typedef struct {
+        UString digest;                 // hex ha1
+        QElapsedTimer cached;           // when taken from authorize
+    } Secret;
+
     static QStringList ServerAliases, ServerNames;
     static UString ServerHostname;
     static UString ServerMode;
@@ -52,8 +114,22 @@ private:
     static Manager *Instance;
     static unsigned Contexts;
     static QThread::Priority Priority;
+    static QAtomicInt Ringing;
+    static int Doorbell;
+    static QAtomicInt Queued, Authorizing;
+    static QAtomicInt QueueLimit, AuthorizeLimit, RequestLimit, RetryAfter;
+    static QMutex NonceLock;
+    static QByteArray NonceKey, PriorKey;
+    static QAtomicInt NonceLifetime;
+    static QAtomicInteger<quint64> CredentialHits, CredentialMisses;
+
+    TimerWheel wheel;
+    QCache<Credential, Secret> credentials;     // ha1 by user, realm, digest
+    qint64 credentialTimeout;           // msecs before asking authorize again
 
     void applyNames();
+    void dispatch(const Event& ev);
+    void authorizeRegistration(const Event& ev, Registry *reg, const UString& secret);
 
     Manager(unsigned order = 0);
     ~Manager() final;
@@ -62,6 +138,11 @@ signals:
     void changeRealm(const QString& realm);
     void findEndpoint(const Event& ev);
 
+private slots:
+    void drainEvents();
+    void runTimers();
+    void flushCredentials();
+
 public slots:
     void refreshRegistration(const Event& ev);
     void createRegistration(const Event& ev, const QVariantHash& endpoint);
@@ -84,9 +165,10 @@ public slots:
  * This is used to coordinate all sip activity and runs in it's own thread.
  * This class is meant to be derived into an application specific manager
  * class to introduce product specific behaviors.  This class directly manages
- * the call, registry, and provider objects.  All context events get signaled
- * to here as well.  By having a separate thread and event loop, and signaling
- * all actions through here (or the derived class), correct order and
+ * the call, registry, and provider objects.  Context events arrive thru
+ * lock-free per context queues, and contexts ring a doorbell once a batch is
+ * queued.  By having a separate thread and event loop, and handling all
+ * actions through here (or the derived class), correct order and
  * synchronization of object and state changes is guaranteed without locking.
  * \author David Sugar <tychosoft@gmail.com>
  */
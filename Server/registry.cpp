@@ -18,49 +18,206 @@
 #include "manager.hpp"
 
 #include <QMultiHash>
+#include <QReadWriteLock>
+
+#define REGISTRY_SHARDS 16      // power of 2
+
+// Shards may be read from context threads under their read lock.  Only
+// the stack thread writes, so it may read them without locking.
+namespace {
+    typedef struct {
+        QReadWriteLock lock;
+        QMultiHash<int, Registry *> extensions;
+        QHash<UString, int> aliases;            // alias to extension
+    } Shard;
+
+    Shard shards[REGISTRY_SHARDS];
+
+    inline Shard& extensionShard(int number) {
+        return shards[static_cast<unsigned>(number) & (REGISTRY_SHARDS - 1)];
+    }
+
+    inline Shard& aliasShard(const UString& alias) {
+        return shards[qHash(alias) & (REGISTRY_SHARDS - 1)];
+    }
+}
 
-static QMultiHash<int, Registry*> extensions;
-static QMultiHash<UString, Registry*> aliases;
 static QHash<QPair<int,UString>, Registry *> registries;
 
+// realms and challenge text are shared by every registry using them...
+static QHash<UString, UString> realms, prefixes;
+
+static const UString internRealm(const UString& realm)
+{
+    auto it = realms.constFind(realm);
+    if(it != realms.constEnd())
+        return *it;
+    realms.insert(realm, realm);
+    return realm;
+}
+
+static const UString challengePrefix(const UString& realm)
+{
+    auto it = prefixes.constFind(realm);
+    if(it != prefixes.constEnd())
+        return *it;
+    UString prefix = "Digest realm=" + realm.quote() + ", nonce=\"";
+    prefixes.insert(realm, prefix);
+    return prefix;
+}
+
+static const UString challengeSuffix(Registry::Digest digest)
+{
+    static const UString md5 = "\", algorithm=\"MD5\"";
+    static const UString sha256 = "\", algorithm=\"SHA-256\"";
+    static const UString sha512 = "\", algorithm=\"SHA-512\"";
+
+    switch(digest) {
+    case Registry::SHA256:
+        return sha256;
+    case Registry::SHA512:
+        return sha512;
+    default:
+        return md5;
+    }
+}
+
 // We create registration records based on the initial pre-authorize
 // request, and as inactive.  The registration becomes active only when
 // it is updated by an authorized request.
 Registry::Registry(const QVariantHash &ep) :
-expires(-1), context(nullptr), endpoint(ep)
-{    
+allows(0), expires(-1), context(nullptr)
+{
     text = ep.value("display").toString();
     alias = ep.value("name").toString();
-    number = ep.value("number").toInt();
+    extension = ep.value("number").toInt();
     label = ep.value("label").toString();
+    authUser = ep.value("user").toString();
+    realmName = internRealm(ep.value("realm").toString());
+    digestType = digestId(ep.value("digest").toString());
+    forwards = ep.value("forward").toStringList();
     expires = 60000l;
 
     updated.start();
+    updateChallenge();
+    Manager::timers().schedule(this, expires);
 
-    QPair<int,UString> key(number, label);
-    extensions.insert(number, this);
-    aliases.insert(alias, this);
+    QPair<int,UString> key(extension, label);
     registries.insert(key, this);
+    {
+        auto& shard = extensionShard(extension);
+        QWriteLocker lock(&shard.lock);
+        shard.extensions.insert(extension, this);
+    }
+    if(!alias.isEmpty()) {
+        auto& shard = aliasShard(alias);
+        QWriteLocker lock(&shard.lock);
+        shard.aliases.insert(alias, extension);
+    }
     qDebug() << "Initializing" << key;
 }
 
 Registry::~Registry()
 {
     if(!context)
-        qDebug() << "Abandoning" << number << label;
+        qDebug() << "Abandoning" << extension << label;
     else {
-        qDebug() << "Releasing" << number << label;
+        qDebug() << "Releasing" << extension << label;
         // may later kill active calls, etc...
     }
-    QPair<int,UString> key(number, label);
+    QPair<int,UString> key(extension, label);
     registries.remove(key);
-    extensions.remove(number, this);
-    aliases.remove(alias, this);
+    {
+        auto& shard = extensionShard(extension);
+        QWriteLocker lock(&shard.lock);
+        shard.extensions.remove(extension, this);
+    }
+
+    // other labels of this extension may still use the alias...
+    if(alias.isEmpty())
+        return;
+    foreach(auto reg, extensionShard(extension).extensions.values(extension)) {
+        if(reg->alias == alias)
+            return;
+    }
+    auto& shard = aliasShard(alias);
+    QWriteLocker lock(&shard.lock);
+    shard.aliases.remove(alias);
+}
+
+// a registration that was never refreshed in time...
+void Registry::expired()
+{
+    qDebug() << "Expiring" << extension << label;
+    delete this;
+}
+
+void Registry::updateChallenge()
+{
+    authPrefix = challengePrefix(realmName);
+    authSuffix = challengeSuffix(digestType);
+}
+
+void Registry::changeRealm(const UString& realm)
+{
+    realms.clear();
+    prefixes.clear();
+
+    auto shared = internRealm(realm);
+    foreach(auto reg, registries) {
+        reg->realmName = shared;
+        reg->updateChallenge();
+    }
+}
+
+Registry::Digest Registry::digestId(const UString& name)
+{
+    auto id = name.toUpper();
+    if(id == "SHA-256" || id == "SHA256")
+        return SHA256;
+    if(id == "SHA-512" || id == "SHA512")
+        return SHA512;
+    return MD5;
+}
+
+const UString Registry::digestName(Digest digest)
+{
+    switch(digest) {
+    case SHA256:
+        return "SHA-256";
+    case SHA512:
+        return "SHA-512";
+    default:
+        return "MD5";
+    }
+}
+
+QCryptographicHash::Algorithm Registry::algorithm() const
+{
+    switch(digestType) {
+    case SHA256:
+        return QCryptographicHash::Sha256;
+    case SHA512:
+        return QCryptographicHash::Sha512;
+    default:
+        return QCryptographicHash::Md5;
+    }
+}
+
+bool Registry::allow(const UString& id) const
+{
+    auto method = Event::methodId(id.constData());
+    if(method)
+        return (allows & method) != 0;
+    return otherAllows.contains(id.toLower());
 }
 
 QList<Registry *> Registry::list()
 {
-    return extensions.values();
+    QList<Registry *> list;
+    for(auto& shard : shards)
+        list << shard.extensions.values();
+    return list;
 }
 
 // to find a registration record associated with a registration event
@@ -83,13 +240,47 @@ QList<Registry *> Registry::find(const UString& target)
     if(target.length() < 1)
         return list;
 
-    if(target.toInt() > 0) {
-        list = extensions.values(target.toInt());
+    auto number = target.toInt();
+    if(number > 0) {
+        list = extensionShard(number).extensions.values(number);
         if(list.count() > 0)
             return list;
     }
 
-    return aliases.values(target);
+    number = aliasShard(target).aliases.value(target, 0);
+    if(number > 0)
+        list = extensionShard(number).extensions.values(number);
+    return list;
+}
+
+// called from context threads, copies what they need under the lock...
+QList<Registry::Target> Registry::lookup(const UString& target)
+{
+    QList<Target> list;
+
+    if(target.length() < 1)
+        return list;
+
+    auto number = target.toInt();
+    if(number < 1) {
+        auto& shard = aliasShard(target);
+        QReadLocker lock(&shard.lock);
+        number = shard.aliases.value(target, 0);
+        if(number < 1)
+            return list;
+    }
+
+    auto& shard = extensionShard(number);
+    QReadLocker lock(&shard.lock);
+    foreach(auto reg, shard.extensions.values(number)) {
+        Target item;
+        item.number = reg->extension;
+        item.context = reg->hasExpired() ? nullptr : reg->context;
+        item.allows = reg->allows;
+        item.address = reg->address;
+        list << item;
+    }
+    return list;
 }
 
 // event handling for registration system as a whole...
@@ -99,13 +290,22 @@ void Registry::process(const Event& ev)
 }
 
 // authorize registration processing
-int Registry::authorize(const Event& ev)
+int Registry::authorize(const Event& ev, const UString& secret, bool& stale)
 {
-    // TODO: validate sip registration....
+    // forged nonces or bad credentials are challenged again...
+    auto nonce = Manager::checkNonce(ev.authorizingOnce(), realmName, ev.source());
+    if(nonce == Manager::INVALID_NONCE || !verify(ev, secret))
+        return SIP_UNAUTHORIZED;
+
+    // good credentials on an aged out nonce get a stale challenge...
+    if(nonce == Manager::STALE_NONCE) {
+        stale = true;
+        return SIP_UNAUTHORIZED;
+    }
 
     // de-registration
-    expires = ev.expires() * 1000l;
-    if(expires < 1) {
+    auto timeout = ev.expires() * 1000l;
+    if(timeout < 1) {
         delete this;
         return SIP_OK;
     }
@@ -115,15 +315,48 @@ int Registry::authorize(const Event& ev)
     else
         qDebug() << "Refreshing" << ev.number() << ev.label() << "for" << ev.expires();
 
+    Binding binding(ev.contact());
+    auto& shard = extensionShard(extension);
+    shard.lock.lockForWrite();
+    expires = timeout;
     context = ev.context();
-    address = ev.contact();
+    address = binding;
+    allows = ev.allows();
+    otherAllows = ev.otherAllows();
     updated.restart();
+    shard.lock.unlock();
+
+    Manager::timers().schedule(this, expires);
     return SIP_OK;
 }
 
+// secret is the hex ha1 for the endpoint, endpoints without one are open
+bool Registry::verify(const Event& ev, const UString& secret) const
+{
+    if(secret.isEmpty())
+        return true;
+
+    auto auth = ev.authorization();
+    if(!auth || !auth->uri)
+        return false;
+
+    auto digest = algorithm();
+    UString uri = UString(auth->uri).unquote();
+    UString qop = auth->message_qop ? UString(auth->message_qop).unquote() : UString();
+    UString ha2 = QCryptographicHash::hash(ev.method() + ":" + uri, digest).toHex();
+    UString expect = secret + ":" + ev.authorizingOnce() + ":";
+    if(!qop.isEmpty()) {
+        if(!auth->nonce_count || !auth->cnonce)
+            return false;
+        expect += UString(auth->nonce_count).unquote() + ":" + UString(auth->cnonce).unquote() + ":" + qop + ":";
+    }
+    expect += ha2;
+    return QCryptographicHash::hash(expect, digest).toHex() == ev.authorizingDigest();
+}
+
 QDebug operator<<(QDebug dbg, const Registry& registry)
 {
     
-    dbg.nospace() << "Registry(" << registry.data() << ")";
+    dbg.nospace() << "Registry(" << registry.number() << "," << registry.realm() << "," << registry.authorizeId() << "," << Registry::digestName(registry.digest()) << ")";
     return dbg.maybeSpace();
 }
@@ -20,30 +20,59 @@
 
 #include "../Common/compiler.hpp"
 #include "context.hpp"
+#include "timer.hpp"
 
 #include <QSqlRecord>
 #include <QElapsedTimer>
+#include <QCryptographicHash>
 
 class LocalSegment;
 class Registry;
 class Event;
 
-class Registry final
+class Registry final : private TimerWheel::Node
 {
     Q_DISABLE_COPY(Registry)
 
 public:
+    typedef struct {
+        int number;
+        Context *context;               // nullptr if inactive or expired
+        quint32 allows;
+        Binding address;
+    } Target;
+
+    typedef enum {
+        MD5,
+        SHA256,
+        SHA512,
+    } Digest;
+
     Registry(const QVariantHash& ep);
     ~Registry();
 
-    inline const QVariantHash data() const {
-        return endpoint;
-    }
-
     const UString display() const {
         return text;
     }
 
+    inline int number() const {
+        return extension;
+    }
+
+    inline const UString realm() const {
+        return realmName;
+    }
+
+    inline Digest digest() const {
+        return digestType;
+    }
+
+    inline const QStringList forwarding() const {
+        return forwards;
+    }
+
+    QCryptographicHash::Algorithm algorithm() const;
+
     inline const UString host() const {
         return address.host();
     }
@@ -60,47 +89,68 @@ public:
         address.refresh(expires);
     }
 
-    inline bool allow(UString id) const {
-        return allows.indexOf(id.toLower()) > -1;
+    inline bool allow(quint32 methods) const {
+        return (allows & methods) == methods;
     }
 
+    bool allow(const UString& id) const;
+
     bool hasExpired() const {
-        return updated.hasExpired(expires * 1000l);
+        return updated.hasExpired(expires);
     }
 
     bool isActive() const {
         return context != nullptr;
     }
 
-    QByteArray nounce() const {
-        return random;
+    inline const UString authorizeId() const {
+        return authUser;
     }
 
-    void setNounce(const QByteArray& value) {
-        random = value;
+    inline const UString challenge(const UString& nonce, bool stale = false) const {
+        UString result;
+        result.reserve(authPrefix.length() + nonce.length() + authSuffix.length() + 12);
+        result.append(authPrefix);
+        result.append(nonce);
+        result.append(authSuffix);
+        if(stale)
+            result.append(", stale=TRUE");
+        return result;
     }
 
-    int authorize(const Event& event);
+    int authorize(const Event& event, const UString& secret, bool& stale);
 
     static Registry *find(const Event& event);      // to find registration
     static QList<Registry *> find(const UString& target);
     static QList<Registry *> list();
+    static QList<Target> lookup(const UString& target); // thread safe
 
     static void process(const Event& event);
+    static void changeRealm(const UString& realm);
+    static Digest digestId(const UString& name);
+    static const UString digestName(Digest digest);
 
 private:
     UString alias, label;
     UString text, agent;
-    int number, rid;
-    qint64 expires;                     // time till expires
-    QByteArray random;                  // nounce value
+    int extension, rid;
+    Digest digestType;                  // digest algorithm
+    quint32 allows;                     // allowed method bits
+    qint64 expires;                     // msecs till expires
     Context *context;                   // context of endpoint
-    Contact address;                    // contact record for endpoint
+    Binding address;                    // contact binding for endpoint
     Contact route;                      // our return route to endpoint
     QElapsedTimer updated;              // when the record was updated
-    QVariantHash endpoint;              // extension + group union
     QList<LocalSegment *> calls;        // local calls on this endpoint
-    QList<UString> allows;
+    QList<UString> otherAllows;         // unknown methods, lowercase
+    QStringList forwards;               // forwarding targets
+    UString realmName;                  // interned, shared by registries
+    UString authPrefix, authSuffix;     // challenge around the nonce
+    UString authUser;                   // x-authorize id
+
+    void updateChallenge();
+    void expired() final;
+    bool verify(const Event& event, const UString& secret) const;
 };
 
 QDebug operator<<(QDebug dbg, const Registry& registry);
@@ -117,7 +167,17 @@ QDebug operator<<(QDebug dbg, const Registry& registry);
  * \class Registry
  * \brief An active registration.
  * A registration consists of a user endpoints that is registered
- * thru the stack which are associated with that user.
+ * thru the stack which are associated with that user.  The static parts
+ * of the digest challenge are pre-computed when the registry is created or
+ * the realm changes, so only a nonce is inserted per challenge.  The
+ * endpoint found by authorize is copied into typed fields once when the
+ * registry is created, and the realm and challenge text are shared
+ * between registries rather than kept per record.  Each
+ * registry is scheduled in the manager's timer wheel, and is removed when
+ * it expires without having been refreshed.  Registries are only created,
+ * changed, and removed from the stack thread.  Extensions and aliases are
+ * kept in sharded tables with a read lock per shard, so that context
+ * threads can use lookup() to check a target directly.
  * \author David Sugar <tychosoft@gmail.com>
  */
 
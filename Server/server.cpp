@@ -18,6 +18,7 @@
 #include "../Common/compiler.hpp"
 #include "server.hpp"
 #include "output.hpp"
+#include "trace.hpp"
 
 #include <QSettings>
 #include <QCommandLineParser>
@@ -68,7 +69,8 @@ enum {
     SERVER_SHUTDOWN,
     SERVER_RELOAD,
     SERVER_SUSPEND,
-    SERVER_RESUME
+    SERVER_RESUME,
+    SERVER_TRACE
 };
 
 class ServerEvent final : public QEvent
@@ -261,6 +263,11 @@ static void handleSignals(int signo)
     case SIGHUP:
         Server::reload();
         break;
+#endif
+#ifdef SIGUSR1
+    case SIGUSR1:
+        Server::trace();
+        break;
 #endif
     }
 }
@@ -280,6 +287,9 @@ static void enableSignals()
 #ifdef SIGHUP
     ::signal(SIGHUP, handleSignals);
 #endif
+#ifdef SIGUSR1
+    ::signal(SIGUSR1, handleSignals);
+#endif
 #ifdef SIGKILL
     ::signal(SIGKILL, handleSignals);
 #endif
@@ -445,6 +455,10 @@ bool Server::event(QEvent *evt)
             RunState = UP;
         }
         return true;
+    case SERVER_TRACE:
+        debug() << "Server(TRACE)";
+        Trace::dump();
+        return true;
     }
     return false;
 }
@@ -603,6 +617,11 @@ void Server::resume()
     QCoreApplication::postEvent(Instance, new ServerEvent(SERVER_RESUME));
 }
 
+void Server::trace()
+{
+    QCoreApplication::postEvent(Instance, new ServerEvent(SERVER_TRACE));
+}
+
 bool Server::shutdown(int reason)
 {
     if(exitReason)
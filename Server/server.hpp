@@ -107,6 +107,7 @@ public:
     static void reload();
     static void suspend();
     static void resume();
+    static void trace();
 
 private:
     typedef QHash<QString, Symbol> ServerEnv;
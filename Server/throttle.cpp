@@ -0,0 +1,137 @@
+/*
+ * Copyright 2017 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "throttle.hpp"
+#include <cstring>
+
+#define THROTTLE_RATE   100     // requests per second per source
+#define THROTTLE_BURST  200     // requests allowed in a burst
+#define THROTTLE_LIMIT  1000000 // keeps milli-tokens in 32 bits
+
+QAtomicInt Throttle::Rate(THROTTLE_RATE);
+QAtomicInt Throttle::Burst(THROTTLE_BURST);
+
+Throttle::Throttle() :
+table(new Bucket[TableSize])
+{
+    memset(table, 0, sizeof(Bucket) * TableSize);
+    clock.start();
+}
+
+Throttle::~Throttle()
+{
+    delete[] table;
+}
+
+void Throttle::applyConfig(const QVariantHash& config)
+{
+    auto rate = config.value("throttle/rate", THROTTLE_RATE).toInt();
+    auto burst = config.value("throttle/burst", THROTTLE_BURST).toInt();
+
+    if(rate < 0)
+        rate = 0;
+    if(rate > THROTTLE_LIMIT)
+        rate = THROTTLE_LIMIT;
+    if(burst > THROTTLE_LIMIT)
+        burst = THROTTLE_LIMIT;
+    if(burst < rate)
+        burst = rate;
+    Burst.storeRelease(burst);
+    Rate.storeRelease(rate);
+}
+
+// find the bucket for a source, or take over a free or oldest one...
+Throttle::Bucket *Throttle::lookup(quint64 key, quint32 now, int rate, int burst)
+{
+    auto mask = TableSize - 1;
+    auto pos = static_cast<unsigned>(key) & mask;
+    Bucket *victim = nullptr;
+
+    for(unsigned probe = 0; probe < TableProbe; ++probe) {
+        auto bucket = &table[(pos + probe) & mask];
+        if(bucket->key == key)
+            return bucket;
+        if(victim && !victim->key)
+            continue;
+        if(!victim || !bucket->key || now - bucket->stamp > now - victim->stamp)
+            victim = bucket;
+    }
+
+    // a bucket idle long enough to refill is as good as free...
+    auto refill = static_cast<quint32>(burst) * 1000u / static_cast<quint32>(rate);
+    if(!victim->key)
+        activeCount.ref();
+    else if(now - victim->stamp < refill)
+        ++evictCount;
+
+    victim->key = key;
+    victim->stamp = now;
+    victim->tokens = burst * 1000;
+    return victim;
+}
+
+bool Throttle::check(const eXosip_event_t *evt)
+{
+    auto rate = Rate.loadAcquire();
+    auto burst = Burst.loadAcquire();
+    if(!evt->request || rate < 1)
+        return true;
+
+    switch(evt->type) {
+    case EXOSIP_MESSAGE_NEW:
+    case EXOSIP_CALL_INVITE:
+        break;
+    default:
+        return true;
+    }
+
+    // source is the received address of the top via, else it's host...
+    osip_via_t *via = nullptr;
+    osip_generic_param_t *param = nullptr;
+    const char *source = nullptr;
+    if(osip_message_get_via(evt->request, 0, &via) < 0 || !via)
+        return true;
+    if(!osip_via_param_get_byname(via, const_cast<char *>("received"), &param) && param && param->gvalue)
+        source = param->gvalue;
+    else
+        source = via->host;
+    if(!source)
+        return true;
+
+    // fnv-1a, with 0 kept for free buckets
+    quint64 key = 14695981039346656037ull;
+    while(*source) {
+        key ^= static_cast<unsigned char>(*(source++));
+        key *= 1099511628211ull;
+    }
+    if(!key)
+        key = 1;
+
+    auto now = static_cast<quint32>(clock.elapsed());
+    auto bucket = lookup(key, now, rate, burst);
+    auto limit = static_cast<qint64>(burst) * 1000;
+    auto tokens = static_cast<qint64>(bucket->tokens) + static_cast<qint64>(now - bucket->stamp) * rate;
+
+    bucket->stamp = now;
+    bucket->tokens = static_cast<qint32>(tokens > limit ? limit : tokens);
+    if(bucket->tokens < 1000) {
+        ++dropCount;
+        return false;
+    }
+    bucket->tokens -= 1000;
+    return true;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2017 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THROTTLE_HPP_
+#define THROTTLE_HPP_
+
+#include "../Common/compiler.hpp"
+#include <QElapsedTimer>
+#include <QAtomicInteger>
+#include <QVariantHash>
+#include <eXosip2/eXosip.h>
+
+class Throttle final
+{
+    Q_DISABLE_COPY(Throttle)
+public:
+    Throttle();
+    ~Throttle();
+
+    bool check(const eXosip_event_t *evt);
+
+    inline quint64 dropped() const {
+        return dropCount.load();
+    }
+
+    inline quint64 evicted() const {
+        return evictCount.load();
+    }
+
+    inline unsigned active() const {
+        return static_cast<unsigned>(activeCount.load());
+    }
+
+    inline static unsigned size() {
+        return TableSize;
+    }
+
+    inline static bool isEnabled() {
+        return Rate.load() > 0;
+    }
+
+    static void applyConfig(const QVariantHash& config);
+
+private:
+    typedef struct {
+        quint64 key;                    // hash of source, 0 if free
+        quint32 stamp;                  // last refill in ms
+        qint32 tokens;                  // milli-tokens left
+    } Bucket;
+
+    Bucket *table;
+    QElapsedTimer clock;
+    QAtomicInteger<quint64> dropCount, evictCount;
+    QAtomicInt activeCount;
+
+    Bucket *lookup(quint64 key, quint32 now, int rate, int burst);
+
+    static const unsigned TableSize = 4096;
+    static const unsigned TableProbe = 4;
+    static QAtomicInt Rate, Burst;
+};
+
+/*!
+ * Rate limiting of new requests by source address.
+ * \file throttle.hpp
+ */
+
+/*!
+ * \class Throttle
+ * \brief Per source token buckets for a context.
+ * Each context owns a fixed size open addressed table of token buckets
+ * keyed by the source address found in the top via.  The table is checked
+ * for new requests before an Event is built, so a flood from a few
+ * addresses is answered without parsing or a trip to the stack.  Buckets
+ * that have been idle long enough to refill are free to reuse, and when a
+ * probe finds none the least recently used bucket is overwritten.  Only
+ * the owning context thread touches the table; the counters may be read
+ * from anywhere.
+ * \author David Sugar <tychosoft@gmail.com>
+ */
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2017 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timer.hpp"
+
+TimerWheel::Node::Node() :
+next(this), prev(this), owner(nullptr), when(0)
+{
+}
+
+TimerWheel::Node::~Node()
+{
+    if(owner)
+        owner->cancel(this);
+}
+
+void TimerWheel::Node::link(Node *head)
+{
+    prev = head->prev;
+    next = head;
+    head->prev->next = this;
+    head->prev = this;
+}
+
+void TimerWheel::Node::unlink()
+{
+    next->prev = prev;
+    prev->next = next;
+    next = prev = this;
+}
+
+TimerWheel::TimerWheel() :
+current(0), active(0)
+{
+    clock.start();
+}
+
+TimerWheel::~TimerWheel()
+{
+    // leave any remaining nodes unscheduled rather than dangling...
+    for(int level = 0; level < Levels; ++level) {
+        for(unsigned index = 0; index < Slots; ++index) {
+            auto head = &wheel[level][index];
+            while(!head->isEmpty()) {
+                head->next->owner = nullptr;
+                head->next->unlink();
+            }
+        }
+    }
+}
+
+void TimerWheel::schedule(Node *node, qint64 timeout)
+{
+    Q_ASSERT(node->owner == nullptr || node->owner == this);
+    if(node->owner)
+        node->unlink();
+    else {
+        node->owner = this;
+        ++active;
+    }
+
+    // at least one tick, and never further out than the wheels reach...
+    auto ticks = (timeout + TickSize - 1) / TickSize;
+    if(ticks < 1)
+        ticks = 1;
+    if(ticks > 0xffffffffll >> 1)
+        ticks = 0xffffffffll >> 1;
+    node->when = current + static_cast<quint32>(ticks);
+    insert(node);
+}
+
+void TimerWheel::cancel(Node *node)
+{
+    if(node->owner != this)
+        return;
+
+    node->unlink();
+    node->owner = nullptr;
+    --active;
+}
+
+// called from the manager's timer, catches up on every tick that passed
+void TimerWheel::advance()
+{
+    auto now = static_cast<quint32>(clock.elapsed() / TickSize);
+    while(current != now) {
+        auto index = ++current & SlotMask;
+        for(int level = 1; !index && level < Levels; ++level) {
+            index = (current >> (level * SlotBits)) & SlotMask;
+            cascade(level, index);
+        }
+        expire(current & SlotMask);
+    }
+}
+
+void TimerWheel::insert(Node *node)
+{
+    auto delta = node->when - current;
+    int level = 0;
+
+    if(static_cast<qint32>(delta) < 0)
+        node->when = current;
+    else {
+        while(level < Levels - 1 && delta >= 1u << ((level + 1) * SlotBits))
+            ++level;
+    }
+
+    auto index = (node->when >> (level * SlotBits)) & SlotMask;
+    node->link(&wheel[level][index]);
+}
+
+void TimerWheel::cascade(int level, unsigned index)
+{
+    Slot list;
+    auto head = &wheel[level][index];
+
+    // move the slot aside first, entries may land back in this wheel...
+    while(!head->isEmpty()) {
+        auto node = head->next;
+        node->unlink();
+        node->link(&list);
+    }
+
+    while(!list.isEmpty()) {
+        auto node = list.next;
+        node->unlink();
+        insert(node);
+    }
+}
+
+void TimerWheel::expire(unsigned index)
+{
+    Slot list;
+    auto head = &wheel[0][index];
+
+    while(!head->isEmpty()) {
+        auto node = head->next;
+        node->unlink();
+        node->link(&list);
+    }
+
+    // expired may cancel or reschedule others still in our list...
+    while(!list.isEmpty()) {
+        auto node = list.next;
+        node->unlink();
+        node->owner = nullptr;
+        --active;
+        node->expired();
+    }
+}
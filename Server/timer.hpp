@@ -0,0 +1,116 @@
+/*
+ * Copyright 2017 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMER_HPP_
+#define TIMER_HPP_
+
+#include "../Common/compiler.hpp"
+#include <QElapsedTimer>
+
+class TimerWheel final
+{
+    Q_DISABLE_COPY(TimerWheel)
+public:
+    class Node
+    {
+        Q_DISABLE_COPY(Node)
+        friend class TimerWheel;
+    public:
+        inline bool isScheduled() const {
+            return owner != nullptr;
+        }
+
+    protected:
+        Node();
+        virtual ~Node();
+
+        // called from the wheel once unlinked, may delete or reschedule
+        virtual void expired() = 0;
+
+    private:
+        Node *next, *prev;
+        TimerWheel *owner;              // wheel we are scheduled in
+        quint32 when;                   // expiration tick
+
+        inline bool isEmpty() const {
+            return next == this;
+        }
+
+        void link(Node *head);
+        void unlink();
+    };
+
+    TimerWheel();
+    ~TimerWheel();
+
+    void schedule(Node *node, qint64 timeout);
+    void cancel(Node *node);
+    void advance();
+
+    inline unsigned count() const {
+        return active;
+    }
+
+    inline static int tick() {
+        return TickSize;
+    }
+
+private:
+    class Slot final : public Node
+    {
+    public:
+        Slot() = default;
+
+    private:
+        void expired() final {}
+    };
+
+    static const int TickSize = 250;    // msecs per tick
+    static const int SlotBits = 8;
+    static const unsigned Slots = 1u << SlotBits;
+    static const unsigned SlotMask = Slots - 1;
+    static const int Levels = 4;
+
+    Slot wheel[Levels][Slots];
+    QElapsedTimer clock;
+    quint32 current;
+    unsigned active;
+
+    void insert(Node *node);
+    void cascade(int level, unsigned index);
+    void expire(unsigned index);
+};
+
+/*!
+ * Timers for the stack thread.
+ * \file timer.hpp
+ */
+
+/*!
+ * \class TimerWheel
+ * \brief A hierarchical timing wheel.
+ * Objects that need to expire, such as registrations, derive from
+ * TimerWheel::Node, which holds the links used to keep them in a wheel
+ * slot.  Scheduling and cancelling are constant time, and each tick only
+ * visits the slot that is due, with entries in the outer wheels cascading
+ * inward as their range comes up.  Nothing ever scans the whole set of
+ * timers.  The wheel is owned and driven by the manager, so it is only
+ * used from the stack thread and needs no locking.
+ * \author David Sugar <tychosoft@gmail.com>
+ */
+
+#endif
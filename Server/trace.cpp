@@ -0,0 +1,139 @@
+/*
+ * Copyright 2017 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.hpp"
+#include "output.hpp"
+#include "../Common/crashhandler.hpp"
+
+#include <QThread>
+#include <QMutex>
+#include <QList>
+#include <QAtomicInteger>
+#include <cstdio>
+#include <cstring>
+
+#define TRACE_RECORDS   256     // records per thread, power of 2
+#define TRACE_CONTEXTS  256     // context names kept for dumps
+
+namespace {
+    class TraceRing final
+    {
+        Q_DISABLE_COPY(TraceRing)
+    public:
+        TraceRing() : head(0) {
+            memset(records, 0, sizeof(records));
+            memset(thread, 0, sizeof(thread));
+            auto current = QThread::currentThread();
+            if(current)
+                qstrncpy(thread, current->objectName().toUtf8().constData(), sizeof(thread));
+        }
+
+        Trace::Record records[TRACE_RECORDS];
+        QAtomicInteger<quint32> head;
+        char thread[32];
+    };
+
+    class TraceCrash final : public CrashHandler
+    {
+    public:
+        TraceCrash() = default;
+
+    private:
+        void crashHandler() final {
+            Trace::crash();
+        }
+    };
+
+    QMutex traceLock;
+    QList<TraceRing *> rings;
+    char contexts[TRACE_CONTEXTS][32];
+    unsigned contextCount = 0;
+    thread_local TraceRing *local = nullptr;
+    TraceCrash crashDump;
+
+    // formatting only happens when dumping...
+    int format(char *buf, size_t size, const TraceRing *ring, const Trace::Record& rec) {
+        const char *ctx = rec.context < contextCount ? contexts[rec.context] : "-";
+        return snprintf(buf, size, "%s: event(%d,cid=%d,did=%d,ctx=%s,source=%.*s:%u) at %lld for %dms",
+            ring->thread, rec.type, rec.cid, rec.did, ctx,
+            static_cast<int>(sizeof(rec.source)), rec.source, rec.port,
+            static_cast<long long>(rec.started), rec.lifetime);
+    }
+}
+
+void Trace::event(qint64 started, qint32 lifetime, int type, int cid, int did, quint16 context, const char *host, quint16 port)
+{
+    // a thread registers it's ring the first time it records...
+    if(!local) {
+        local = new TraceRing();
+        QMutexLocker lock(&traceLock);
+        rings << local;
+    }
+
+    auto pos = local->head.load();
+    auto& rec = local->records[pos & (TRACE_RECORDS - 1)];
+    rec.started = started;
+    rec.lifetime = lifetime;
+    rec.type = type;
+    rec.cid = cid;
+    rec.did = did;
+    rec.context = context;
+    rec.port = port;
+    if(host)
+        strncpy(rec.source, host, sizeof(rec.source));
+    else
+        rec.source[0] = 0;
+    local->head.storeRelease(pos + 1);
+}
+
+quint16 Trace::context(const QString& name)
+{
+    QMutexLocker lock(&traceLock);
+    if(contextCount >= TRACE_CONTEXTS)
+        return TRACE_CONTEXTS;
+    qstrncpy(contexts[contextCount], name.toUtf8().constData(), sizeof(contexts[contextCount]));
+    return static_cast<quint16>(contextCount++);
+}
+
+void Trace::dump()
+{
+    char buf[160];
+    QMutexLocker lock(&traceLock);
+    foreach(auto ring, rings) {
+        quint32 head = ring->head.loadAcquire();
+        quint32 pos = head > TRACE_RECORDS ? head - TRACE_RECORDS : 0;
+        while(pos < head) {
+            format(buf, sizeof(buf), ring, ring->records[pos++ & (TRACE_RECORDS - 1)]);
+            notice() << buf;
+        }
+    }
+}
+
+// no locks here, we may have crashed holding one...
+void Trace::crash()
+{
+    char buf[160];
+    foreach(auto ring, rings) {
+        quint32 head = ring->head.loadAcquire();
+        quint32 pos = head > TRACE_RECORDS ? head - TRACE_RECORDS : 0;
+        while(pos < head) {
+            format(buf, sizeof(buf), ring, ring->records[pos++ & (TRACE_RECORDS - 1)]);
+            fprintf(stderr, "%s\n", buf);
+        }
+    }
+    fflush(stderr);
+}
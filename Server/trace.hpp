@@ -0,0 +1,63 @@
+/*
+ * Copyright 2017 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+
+#include "../Common/compiler.hpp"
+#include <QtGlobal>
+#include <QString>
+
+class Trace final
+{
+    Q_DISABLE_COPY(Trace)
+public:
+    typedef struct {
+        qint64 started;                 // monotonic ms of event creation
+        qint32 lifetime;                // ms event was alive
+        qint32 type, cid, did;
+        quint16 context, port;          // context trace id, source port
+        char source[40];                // source host, may be truncated
+    } Record;
+
+    static void event(qint64 started, qint32 lifetime, int type, int cid, int did, quint16 context, const char *host, quint16 port);
+    static quint16 context(const QString& name);
+    static void dump();
+    static void crash();
+
+private:
+    Trace() = delete;
+};
+
+/*!
+ * Low overhead event lifecycle tracing.
+ * \file trace.hpp
+ */
+
+/*!
+ * \class Trace
+ * \brief Per thread binary event trace rings.
+ * Each thread that releases events records them into it's own fixed size
+ * ring of binary records, which costs a few stores and no locks or heap
+ * allocation.  Records are only formatted when the rings are dumped, either
+ * thru a control command (SIGUSR1) into the log, or to stderr on a crash.
+ * A dump may race with writers, so a record being written at that moment
+ * may show partly updated.
+ * \author David Sugar <tychosoft@gmail.com>
+ */
+
+#endif